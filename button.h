@@ -23,7 +23,6 @@ typedef struct Button {
 } Button;
 
 void button_new(Button *button, uint8_t pin, uint8_t poll_freq);
-extern void button_destroy(Button *);
 extern void button_update(Button *);
 extern bool button_is_pressed(Button *);
 extern bool button_is_released(Button *);
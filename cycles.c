@@ -0,0 +1,136 @@
+/**
+ * \file cycles.c
+ *
+ * Cycle counters for the debug build (see `cycles.h`). This uses
+ * `TIMER1`, which the firmware does not otherwise need, with no
+ * prescaler.
+ */
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <util/delay_basic.h>
+
+#include "cycles.h"
+
+struct cycle_counter cycle_counters[NUM_CYCLE_COUNTERS];
+
+/** Number of times `TCNT1` has overflowed. */
+volatile uint32_t cycles_overflows = 0;
+
+/** Cycles measured in interrupt handlers, which are not charged to the
+ * code they interrupted. */
+volatile uint32_t cycles_isr = 0;
+
+/** Cycles that an empty measurement takes. */
+uint32_t cycles_overhead = 0;
+
+/** Cycles that one `TIMER1_OVF_vect` takes, in 1/16ths of a cycle. */
+uint32_t cycles_overflow_cost = 0;
+
+#ifndef CYCLES_CALIBRATE_LOOPS
+/** Iterations of the 4-cycle delay loop used to time the overflow
+ * interrupt; about 40 overflows. */
+#define CYCLES_CALIBRATE_LOOPS 2560
+#endif
+
+ISR(TIMER1_OVF_vect) {
+    cycles_overflows++;
+}
+
+/** Return the cycles since `init_cycles()`.
+ *
+ * An overflow that happened after interrupts were disabled (by the
+ * caller, or by us) is still pending in `TIFR`, so `TCNT1` has wrapped
+ * but `cycles_overflows` has not been incremented yet.
+ */
+uint32_t cycles_now() {
+    uint32_t high;
+    uint8_t low;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        low = TCNT1;
+        high = cycles_overflows;
+        if ((TIFR & 1<<TOV1) && low < 128)
+            high++;
+    }
+
+    return high << 8 | low;
+}
+
+/** Start a measurement to be charged to `counter`. */
+void cycles_begin(struct cycle_mark *mark, uint8_t counter) {
+    mark->counter = counter;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        mark->isr = cycles_isr;
+        mark->overflows = cycles_overflows;
+    }
+    mark->start = cycles_now();
+}
+
+/** Return the cycles since `mark`, excluding interrupt handlers. */
+static uint32_t elapsed(struct cycle_mark *mark) {
+    uint32_t cycles = cycles_now() - mark->start,
+             isr;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        isr = cycles_isr - mark->isr +
+            ((cycles_overflows - mark->overflows) * cycles_overflow_cost) / 16;
+    }
+
+    cycles = cycles > isr ? cycles - isr : 0;
+    return cycles > cycles_overhead ? cycles - cycles_overhead : 0;
+}
+
+static void charge(struct cycle_mark *mark, uint32_t cycles) {
+    struct cycle_counter *counter = &cycle_counters[mark->counter];
+
+    counter->calls++;
+    counter->cycles += cycles;
+}
+
+/** End a measurement in `loop()`. */
+void cycles_end(struct cycle_mark *mark) {
+    charge(mark, elapsed(mark));
+}
+
+/** End a measurement in an interrupt handler. */
+void cycles_isr_end(struct cycle_mark *mark) {
+    uint32_t cycles = elapsed(mark);
+
+    charge(mark, cycles);
+    cycles_isr += cycles + cycles_overhead;
+}
+
+/** Start `TIMER1` and measure the cost of a measurement and of the
+ * overflow interrupt.
+ *
+ * This must run before interrupts are enabled. The overflow interrupt
+ * is timed over a delay loop of known length, with no other interrupt
+ * enabled yet: whatever the loop took beyond its own cycles was spent
+ * in the overflows that happened during it.
+ */
+void init_cycles() {
+    struct cycle_mark mark;
+    uint32_t cycles, overflows;
+
+    // Normal mode, no prescaler
+    TCNT1 = 0;
+    TCCR1 = 1<<CS10;
+
+    // Enable timer overflow interrupt
+    TIMSK |= 1<<TOIE1;
+
+    cycles_begin(&mark, 0);
+    cycles_overhead = elapsed(&mark);
+
+    sei();
+    cycles_begin(&mark, 0);
+    _delay_loop_2(CYCLES_CALIBRATE_LOOPS);
+    cli();
+    cycles = elapsed(&mark);
+
+    overflows = cycles_overflows - mark.overflows;
+    if (overflows && cycles > 4UL * CYCLES_CALIBRATE_LOOPS)
+        cycles_overflow_cost = (cycles - 4UL * CYCLES_CALIBRATE_LOOPS) * 16 / overflows;
+}
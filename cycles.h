@@ -0,0 +1,82 @@
+/**
+ * \file cycles.h
+ *
+ * Cycle counters for the interrupt handlers, each pass through `loop()`
+ * and each state handler, built when `CYCLE_COUNTERS` is defined (`make
+ * CYCLES=1`). Otherwise the macros below compile to nothing.
+ *
+ * Timer1 runs free at the CPU clock, and its overflow interrupt extends
+ * it to 32 bits. Each counter records the number of calls and the
+ * cycles they took, less the cost of the measurement itself. Cycles
+ * spent in interrupt handlers are not charged to `loop()` or the state
+ * handlers. That includes the Timer1 overflow interrupt, which fires
+ * every 256 cycles. Its cost is measured once at startup, and each
+ * overflow during a measurement is subtracted at that cost. Read the
+ * counters with `sim/cycles.gdb`.
+ */
+
+#ifndef _cycles_h
+#define _cycles_h
+
+#ifdef CYCLE_COUNTERS
+
+#include <stdint.h>
+#include "states.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum CYCLE_COUNTER {
+    CYCLES_TIMER0_COMPA,    /**< `millis()` timer interrupt */
+    CYCLES_PCINT0,          /**< Pin change interrupt */
+    CYCLES_LOOP,            /**< One pass through `loop()` */
+    CYCLES_STATE,           /**< Handler for `STATE_START`; other states follow */
+    NUM_CYCLE_COUNTERS = CYCLES_STATE + STATE_QUIT + 1
+};
+
+struct cycle_counter {
+    uint32_t calls,         /**< Number of measurements */
+             cycles;        /**< Total cycles measured */
+};
+
+/** Start of a measurement. */
+struct cycle_mark {
+    uint32_t start,         /**< `cycles_now()` at the start */
+             isr,           /**< `cycles_isr` at the start */
+             overflows;     /**< `cycles_overflows` at the start */
+    uint8_t counter;        /**< Counter to charge */
+};
+
+extern struct cycle_counter cycle_counters[NUM_CYCLE_COUNTERS];
+extern volatile uint32_t cycles_overflows;
+
+void init_cycles();
+uint32_t cycles_now();
+void cycles_begin(struct cycle_mark *mark, uint8_t counter);
+void cycles_end(struct cycle_mark *mark);
+void cycles_isr_end(struct cycle_mark *mark);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define CYCLES_INIT() init_cycles()
+#define CYCLES_BEGIN(mark, counter) \
+    struct cycle_mark mark; \
+    cycles_begin(&mark, counter)
+#define CYCLES_END(mark) cycles_end(&mark)
+#define CYCLES_ISR_BEGIN(mark, counter) CYCLES_BEGIN(mark, counter)
+#define CYCLES_ISR_END(mark) cycles_isr_end(&mark)
+
+#else
+
+#define CYCLES_INIT()
+#define CYCLES_BEGIN(mark, counter)
+#define CYCLES_END(mark)
+#define CYCLES_ISR_BEGIN(mark, counter)
+#define CYCLES_ISR_END(mark)
+
+#endif // CYCLE_COUNTERS
+
+#endif // _cycles_h
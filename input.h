@@ -18,7 +18,6 @@ typedef struct Input {
 } Input;
 
 void input_new(Input *input, int pin, bool pullup);
-extern void input_delete(Input *);
 extern void input_update(Input *);
 extern bool input_went_high(Input *);
 extern bool input_went_low(Input *);
@@ -10,6 +10,8 @@
 #include <avr/io.h>
 #include <util/atomic.h>
 
+#include "cycles.h"
+
 volatile unsigned long timer_millis = 0;
 
 /** Timer interrupt service routine.
@@ -18,7 +20,9 @@ volatile unsigned long timer_millis = 0;
  * target value stored in `OCR0A`.
  */
 ISR(TIMER0_COMPA_vect) {
+    CYCLES_ISR_BEGIN(mark, CYCLES_TIMER0_COMPA);
     timer_millis++;
+    CYCLES_ISR_END(mark);
 }
 
 /** Initialize the millis service.
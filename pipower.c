@@ -11,6 +11,7 @@
 
 #include "bool.h"
 #include "button.h"
+#include "cycles.h"
 #include "millis.h"
 #include "input.h"
 #include "pins.h"
@@ -19,7 +20,9 @@
 /** \defgroup Button Power button
  * @{
  */
+#ifndef LONG_PRESS_DURATION
 #define LONG_PRESS_DURATION 2000    /**< Length of long press */
+#endif
 #define BUTTON_NORMAL 0             /**< Process button events normally */
 #define BUTTON_IGNORE 1             /**< Power button must be released */
 /** @} */
@@ -76,9 +79,16 @@ Input boot;    /**< BOOT signal from Raspberry Pi */
  *
  * We rely on the pin change interrupt to wake from `SLEEP_PWRDOWN` mode, 
  * but we do not otherwise need to handle the interrupt, so this is a
- * do-nothing routine.
+ * do-nothing routine. The cycle counting build counts its calls.
  */
+#ifdef CYCLE_COUNTERS
+ISR(PCINT0_vect) {
+    CYCLES_ISR_BEGIN(mark, CYCLES_PCINT0);
+    CYCLES_ISR_END(mark);
+}
+#else
 EMPTY_INTERRUPT(PCINT0_vect);
+#endif
 
 /** Run once when mc boots. */
 void setup() {
@@ -94,6 +104,7 @@ void setup() {
     input_new(&usb, PIN_USB, false);
     input_new(&boot, PIN_BOOT, true);
 
+    CYCLES_INIT();
     init_millis();
 }
 
@@ -113,6 +124,8 @@ void loop() {
     bool long_press = false,
          short_press = false;
 
+    CYCLES_BEGIN(loop_mark, CYCLES_LOOP);
+
     now = millis();
     input_update(&usb);
     input_update(&boot);
@@ -144,6 +157,8 @@ void loop() {
         }
     }
 
+    CYCLES_BEGIN(state_mark, CYCLES_STATE + state);
+
     switch(state) {
         case STATE_START:
             if (input_is_high(&usb)) {
@@ -293,9 +308,12 @@ void loop() {
 
         case STATE_QUIT:
             /* This state is only used during debugging to force a main loop
-             * exit. */
-            return;
+             * exit; main() stops calling us. */
+            break;
     }
+
+    CYCLES_END(state_mark);
+    CYCLES_END(loop_mark);
 }
 
 int main() {
@@ -0,0 +1,278 @@
+/**
+ * \file bench-events.c
+ *
+ * Microbenchmark of `pipowerd` event handling using the fake GPIO backend.
+ *
+ * This starts `pipowerd -G fake` with a number of `--bind` lines whose
+ * command writes a byte to file descriptor 3, which is a pipe back to us.
+ * It then measures:
+ *
+ * - latency: time from generating a single edge to its command running,
+ *   one edge at a time;
+ * - throughput: edges per second handled during a storm of edges spread
+ *   over all bound lines.
+ *
+ * Finally it asserts the primary SHUTDOWN line so that `pipowerd` exits.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef DEFAULT_PIPOWERD
+/** Path to the pipowerd binary under test */
+#define DEFAULT_PIPOWERD "./pipowerd"
+#endif
+
+/** Device name used for all bindings */
+#define BENCH_DEVICE "gpiochip9"
+
+/** Offset of the primary SHUTDOWN line */
+#define BENCH_SHUTDOWN_PIN 63
+
+#define OPT_PIPOWERD 'x'    /**< `--pipowerd|-x <path>` */
+#define OPT_LINES 'l'       /**< `--lines|-l <count>` */
+#define OPT_ROUNDS 'r'      /**< `--rounds|-r <count>` */
+#define OPT_STORM 's'       /**< `--storm|-s <count>` */
+#define OPT_HELP 'h'        /**< `--help|-h` */
+
+#define OPTSTRING "x:l:r:s:h"
+
+const struct option longopts[] = {
+    {"pipowerd", required_argument, 0, OPT_PIPOWERD},
+    {"lines", required_argument, 0, OPT_LINES},
+    {"rounds", required_argument, 0, OPT_ROUNDS},
+    {"storm", required_argument, 0, OPT_STORM},
+    {"help", no_argument, 0, OPT_HELP},
+    {0, 0, 0, 0},
+};
+
+/** Benchmark configuration */
+struct config {
+    char *pipowerd;     /**< pipowerd binary */
+    int lines,          /**< number of bound lines */
+        rounds,         /**< number of latency samples */
+        storm;          /**< number of edges in the storm */
+} config = {
+    .pipowerd = DEFAULT_PIPOWERD,
+    .lines = 8,
+    .rounds = 200,
+    .storm = 2000,
+};
+
+int script_fd,      /**< write end of pipowerd's fake GPIO script */
+    ack_fd;         /**< read end of the pipe written by bound commands */
+
+uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void usage(FILE *out) {
+    fprintf(out, "bench-events: usage: bench-events [-x <pipowerd>] [-l <lines>] "
+                 "[-r <rounds>] [-s <storm>]\n");
+}
+
+void parse_args(int argc, char *argv[]) {
+    int ch;
+
+    while (EOF != (ch = getopt_long(argc, argv, OPTSTRING, longopts, NULL))) {
+        switch (ch) {
+            case OPT_PIPOWERD:
+                config.pipowerd = optarg;
+                break;
+
+            case OPT_LINES:
+                config.lines = atoi(optarg);
+                if (config.lines < 1 || config.lines >= BENCH_SHUTDOWN_PIN) {
+                    fprintf(stderr, "bench-events: invalid line count: %s\n", optarg);
+                    exit(2);
+                }
+                break;
+
+            case OPT_ROUNDS:
+                config.rounds = atoi(optarg);
+                break;
+
+            case OPT_STORM:
+                config.storm = atoi(optarg);
+                break;
+
+            case OPT_HELP:
+                usage(stdout);
+                exit(0);
+
+            default:
+                usage(stderr);
+                exit(2);
+        }
+    }
+}
+
+/** Start pipowerd with its script on stdin and our ack pipe on fd 3. */
+pid_t start_pipowerd() {
+    int script[2], ack[2];
+    char **argv;
+    char pin[16];
+    pid_t pid;
+    int i, argc = 0;
+
+    if (pipe(script) == -1 || pipe(ack) == -1) {
+        perror("bench-events: pipe");
+        exit(1);
+    }
+
+    argv = calloc(2 * config.lines + 12, sizeof(char *));
+    argv[argc++] = config.pipowerd;
+    argv[argc++] = "-G";
+    argv[argc++] = "fake";
+    argv[argc++] = "-d";
+    argv[argc++] = BENCH_DEVICE;
+    argv[argc++] = "-p";
+    snprintf(pin, sizeof(pin), "%d", BENCH_SHUTDOWN_PIN);
+    argv[argc++] = pin;
+    argv[argc++] = "-c";
+    argv[argc++] = "true";
+    for (i = 0; i < config.lines; i++) {
+        argv[argc++] = "-b";
+        argv[argc] = malloc(64);
+        snprintf(argv[argc++], 64, BENCH_DEVICE ":%d:printf x >&3", i);
+    }
+
+    pid = fork();
+    if (pid == -1) {
+        perror("bench-events: fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        dup2(script[0], 0);
+        dup2(ack[1], 3);
+        close(script[1]);
+        close(ack[0]);
+        execv(config.pipowerd, argv);
+        perror("bench-events: exec");
+        _exit(127);
+    }
+
+    close(script[0]);
+    close(ack[1]);
+    script_fd = script[1];
+    ack_fd = ack[0];
+
+    return pid;
+}
+
+/** Raise and lower a line, stamping the rising edge with the current time. */
+void edge(int pin) {
+    char line[128];
+    int len;
+
+    len = snprintf(line, sizeof(line),
+            BENCH_DEVICE " %d 1 %" PRIu64 "\n" BENCH_DEVICE " %d 0\n",
+            pin, now_ns(), pin);
+    if (write(script_fd, line, len) != len) {
+        perror("bench-events: write");
+        exit(1);
+    }
+}
+
+/** Wait for `count` commands to report in. */
+void wait_acks(int count) {
+    char buf[256];
+
+    while (count > 0) {
+        ssize_t len = read(ack_fd, buf, (size_t)count < sizeof(buf) ? (size_t)count : sizeof(buf));
+
+        if (len <= 0) {
+            fprintf(stderr, "bench-events: pipowerd went away\n");
+            exit(1);
+        }
+        count -= len;
+    }
+}
+
+int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/** Nearest-rank percentile of sorted samples, in microseconds. */
+double percentile(uint64_t *samples, int n, double p) {
+    int rank = (int)(p * n + 0.999999);
+
+    if (rank < 1)
+        rank = 1;
+    return samples[rank - 1] / 1000.0;
+}
+
+void bench_latency() {
+    uint64_t *samples = calloc(config.rounds, sizeof(uint64_t));
+    int i;
+
+    for (i = 0; i < config.rounds; i++) {
+        uint64_t start = now_ns();
+
+        edge(i % config.lines);
+        wait_acks(1);
+        samples[i] = now_ns() - start;
+    }
+
+    qsort(samples, config.rounds, sizeof(uint64_t), compare_u64);
+    printf("latency: n=%d p50=%.1f p90=%.1f p99=%.1f max=%.1f (us)\n",
+            config.rounds,
+            percentile(samples, config.rounds, 0.50),
+            percentile(samples, config.rounds, 0.90),
+            percentile(samples, config.rounds, 0.99),
+            percentile(samples, config.rounds, 1.00));
+    free(samples);
+}
+
+void bench_storm() {
+    uint64_t start, elapsed;
+    int i;
+
+    start = now_ns();
+    for (i = 0; i < config.storm; i++)
+        edge(i % config.lines);
+    wait_acks(config.storm);
+    elapsed = now_ns() - start;
+
+    printf("storm: edges=%d lines=%d elapsed=%.3f s rate=%.0f edges/s\n",
+            config.storm, config.lines, elapsed / 1e9,
+            config.storm / (elapsed / 1e9));
+}
+
+int main(int argc, char *argv[]) {
+    int status;
+    pid_t pid;
+
+    parse_args(argc, argv);
+    pid = start_pipowerd();
+
+    if (config.rounds > 0)
+        bench_latency();
+    if (config.storm > 0)
+        bench_storm();
+
+    edge(BENCH_SHUTDOWN_PIN);
+    close(script_fd);
+    waitpid(pid, &status, 0);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "bench-events: pipowerd failed (status %d)\n", status);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# Measure the latency between a rising edge on the SHUTDOWN pin and
+# pipowerd running its shutdown command, with and without --realtime,
+# while the system is under CPU and memory pressure.
+#
+# This needs a loopback: wire BENCH_DRIVE_PIN (an output) to
+# PIN_SHUTDOWN. It uses the `gpio` utility (as does
+# pipower-boot.service) to generate edges and `stress-ng` to load the
+# system. The latency is measured by pipowerd itself, from the kernel's
+# timestamp of the edge to the moment it starts the shutdown command,
+# so neither `gpio` nor the command is part of it.
+
+: ${GPIO_CHIP:=/dev/gpiochip0}
+: ${PIN_SHUTDOWN:=17}
+: ${BENCH_DRIVE_PIN:=27}
+: ${BENCH_ITERATIONS:=50}
+: ${BENCH_SETTLE:=5}
+: ${BENCH_STRESS:=--cpu 0 --vm 2 --vm-bytes 90%}
+: ${PIPOWERD:=./pipowerd}
+
+workdir=$(mktemp -d)
+trap 'rm -rf $workdir; [ -n "$stress_pid" ] && kill $stress_pid' EXIT
+
+# run_one <mode> <pipowerd args...>
+run_one() {
+    mode=$1
+    shift
+
+    gpio -g write $BENCH_DRIVE_PIN 0
+
+    $PIPOWERD -d $GPIO_CHIP -p $PIN_SHUTDOWN -c true -v "$@" \
+        2> $workdir/stderr &
+    pid=$!
+
+    # Give the system time to push an idle pipowerd out of memory
+    sleep $BENCH_SETTLE
+
+    gpio -g write $BENCH_DRIVE_PIN 1
+    wait $pid
+
+    us=$(sed -n 's/^pipower: started shutdown command \([0-9]*\) us after the edge$/\1/p' \
+        $workdir/stderr)
+    if [ -n "$us" ]; then
+        echo $us >> $workdir/$mode
+    else
+        echo "bench: pipowerd exited without running command" >&2
+        sed 's/^/    /' $workdir/stderr >&2
+    fi
+}
+
+# report <mode>: print latency percentiles in microseconds
+report() {
+    sort -n $workdir/$1 | awk -v mode=$1 '
+        { v[NR] = $1 }
+        END {
+            if (NR == 0) exit
+            printf "%-10s n=%d p50=%d p90=%d p99=%d max=%d (us)\n", mode, NR,
+                v[int(NR * 0.50) + (NR * 0.50 > int(NR * 0.50))],
+                v[int(NR * 0.90) + (NR * 0.90 > int(NR * 0.90))],
+                v[int(NR * 0.99) + (NR * 0.99 > int(NR * 0.99))],
+                v[NR]
+        }'
+}
+
+gpio -g mode $BENCH_DRIVE_PIN output
+
+stress-ng $BENCH_STRESS --quiet &
+stress_pid=$!
+
+i=0
+while [ $i -lt $BENCH_ITERATIONS ]; do
+    run_one normal
+    run_one realtime --realtime
+    i=$((i + 1))
+done
+
+report normal
+report realtime
@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Check how pipowerd reacts to shutdown requests, using the fake GPIO
+# backend: a rising edge on the primary pin, a request that is already
+# active at startup (with and without --ignore-initial-state), and the
+# end of the script.
+#
+# Each case feeds a script to pipowerd and checks which commands ran and
+# the exit status. Prints one line per case and exits non-zero if any
+# failed.
+
+: ${PIPOWERD:=./pipowerd}
+: ${CHECK_TIMEOUT:=5}
+: ${CHECK_SETTLE:=0.1}
+
+workdir=$(mktemp -d)
+trap 'rm -rf $workdir' EXIT
+
+failures=0
+high=
+
+# check <name> <script> <expected status> <expected commands> <pipowerd args...>
+#
+# <expected status> is a number, or "error" for any failure.
+# <expected commands> lists the commands that should have run, in
+# alphabetical order, as a space-separated list of "bound" and
+# "primary". Lines in $high are high at startup.
+check() {
+    name=$1 script=$2 expect_status=$3 expect_ran=$4
+    shift 4
+
+    rm -f $workdir/ran
+    printf "$script" | PIPOWERD_FAKE_HIGH=$high timeout $CHECK_TIMEOUT $PIPOWERD -G fake \
+        -c "echo primary >> $workdir/ran" "$@" 2> $workdir/stderr
+    status=$?
+    [ "$expect_status" = error ] && [ $status -ne 0 ] && [ $status -ne 124 ] && status=error
+
+    # Bound commands run in the background
+    sleep $CHECK_SETTLE
+    ran=$(sort $workdir/ran 2> /dev/null | tr '\n' ' ')
+    ran=${ran% }
+
+    if [ "$status" = 124 ]; then
+        echo "FAIL: $name: timed out"
+    elif [ "$status" != "$expect_status" ]; then
+        echo "FAIL: $name: exit status $status, expected $expect_status"
+    elif [ "$ran" != "$expect_ran" ]; then
+        echo "FAIL: $name: ran '$ran', expected '$expect_ran'"
+    else
+        echo "ok: $name"
+        return
+    fi
+
+    sed 's/^/    /' $workdir/stderr
+    failures=$((failures + 1))
+}
+
+check "primary edge" 'gpiochip0 17 1\n' 0 primary
+
+check "primary edge after it was low" 'gpiochip0 17 0\ngpiochip0 17 1\n' 0 primary
+
+check "no edge before end of script" 'gpiochip0 17 0\n' error ""
+
+high=gpiochip0:17
+check "active at startup" '' 0 primary
+check "active at startup, ignored" '' error "" -i
+check "active at startup, ignored, then re-asserted" \
+    'gpiochip0 17 0\ngpiochip0 17 1\n' 0 primary -i
+
+high=gpiochip0:5
+check "bound pin active at startup" 'gpiochip0 17 1\n' 0 "bound primary" \
+    -b "gpiochip0:5:echo bound >> $workdir/ran"
+check "bound pin active at startup, ignored" 'gpiochip0 17 1\n' 0 primary -i \
+    -b "gpiochip0:5:echo bound >> $workdir/ran"
+
+high=
+check "bound pin, then end of script" 'gpiochip0 5 1\n' error bound \
+    -b "gpiochip0:5:echo bound >> $workdir/ran"
+
+check "invalid pin in binding" 'gpiochip0 17 1\n' error "" \
+    -b "gpiochip0:abc:echo bound >> $workdir/ran"
+
+check "primary on a chip given without /dev" 'gpiochip1 17 1\n' 0 primary -d gpiochip1
+
+[ $failures -eq 0 ]
@@ -0,0 +1,102 @@
+/**
+ * \file gpio-chardev.c
+ *
+ * GPIO backend using the Linux GPIO character device (v2) interface.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/gpio.h>
+
+#include "gpio.h"
+
+/** Number of kernel events to read at once */
+#define CHARDEV_BATCH 16
+
+/** Request rising edge events for all lines with a single line request. */
+static int chardev_request(struct gpio_request *req) {
+    struct gpio_v2_line_request lreq;
+    unsigned int i;
+    int fd, ret;
+
+    if (req->nlines > GPIO_V2_LINES_MAX)
+        return -E2BIG;
+
+    fd = open(req->device, 0);
+    if (fd == -1)
+        return -errno;
+
+    memset(&lreq, 0, sizeof(lreq));
+    for (i = 0; i < req->nlines; i++)
+        lreq.offsets[i] = req->offsets[i];
+    lreq.num_lines = req->nlines;
+    lreq.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING;
+    strcpy(lreq.consumer, "pipower-shutdown");
+
+    ret = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &lreq);
+    ret = (ret == -1) ? -errno : 0;
+    close(fd);
+    if (ret < 0)
+        return ret;
+
+    // We drain events until the kernel has no more for us, so reads
+    // must not block.
+    fcntl(lreq.fd, F_SETFL, O_NONBLOCK);
+    req->fd = lreq.fd;
+
+    return 0;
+}
+
+/** Read current values of all requested lines. */
+static int chardev_get_values(struct gpio_request *req, uint64_t *bits) {
+    struct gpio_v2_line_values values;
+
+    values.mask = (req->nlines == 64) ? ~0ULL : (1ULL << req->nlines) - 1;
+    if (ioctl(req->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) == -1)
+        return -errno;
+
+    *bits = values.bits;
+    return 0;
+}
+
+/** Read pending edge events.
+ *
+ * v2 line events are stamped with CLOCK_MONOTONIC, so the kernel
+ * timestamp is passed on unchanged.
+ */
+static int chardev_read_events(struct gpio_request *req, struct gpio_event *events, int max) {
+    struct gpio_v2_line_event kevents[CHARDEV_BATCH];
+    ssize_t len;
+    int i, n;
+
+    if (max > CHARDEV_BATCH)
+        max = CHARDEV_BATCH;
+
+    len = read(req->fd, kevents, max * sizeof(kevents[0]));
+    if (len == -1)
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -errno;
+
+    if (len % sizeof(kevents[0]) != 0)
+        return -EIO;
+
+    n = len / sizeof(kevents[0]);
+    for (i = 0; i < n; i++) {
+        events[i].req = req;
+        events[i].offset = kevents[i].offset;
+        events[i].timestamp_ns = kevents[i].timestamp_ns;
+    }
+
+    return n;
+}
+
+const struct gpio_backend gpio_chardev_backend = {
+    .name = "chardev",
+    .request = chardev_request,
+    .get_values = chardev_get_values,
+    .read_events = chardev_read_events,
+};
@@ -0,0 +1,222 @@
+/**
+ * \file gpio-fake.c
+ *
+ * Scripted GPIO backend for testing and benchmarking without hardware.
+ *
+ * Line changes are read as text from the file descriptor named by
+ * `PIPOWERD_FAKE_FD` (default: standard input), one per line:
+ *
+ *     <device> <pin> <value> [<timestamp_ns>]
+ *
+ * A change from 0 to 1 on a requested line produces a rising edge
+ * event. The optional timestamp (CLOCK_MONOTONIC) lets a driver measure
+ * latency from the moment it generated the edge; otherwise the time at
+ * which the line was read is used. Lines listed in `PIPOWERD_FAKE_HIGH`
+ * as `<device>:<pin>[,...]` are high at startup. `<device>` may be given
+ * with or without a leading `/dev/`.
+ *
+ * End of input is reported as `ENODATA`.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gpio.h"
+
+#ifndef FAKE_MAX_REQUESTS
+/** Maximum number of requests the fake backend can track */
+#define FAKE_MAX_REQUESTS 16
+#endif
+
+/** Size of the input line buffer */
+#define FAKE_BUFSIZE 4096
+
+static struct gpio_request *requests[FAKE_MAX_REQUESTS];
+static uint64_t values[FAKE_MAX_REQUESTS];
+static int nrequests;
+
+static int script_fd = -1;
+static char buf[FAKE_BUFSIZE];
+static size_t buflen;
+static int eof;
+
+/** Return true if script device `name` refers to request device `device`. */
+static int device_matches(const char *device, const char *name, size_t len) {
+    if (strncmp(device, "/dev/", 5) == 0 && strncmp(name, "/dev/", 5) != 0)
+        device += 5;
+
+    return strlen(device) == len && strncmp(device, name, len) == 0;
+}
+
+/** Find the request and line index for `<device> <pin>`. */
+static int find_line(const char *name, size_t len, unsigned int pin, int *line) {
+    unsigned int i;
+    int r;
+
+    for (r = 0; r < nrequests; r++) {
+        if (!device_matches(requests[r]->device, name, len))
+            continue;
+
+        for (i = 0; i < requests[r]->nlines; i++) {
+            if (requests[r]->offsets[i] == pin) {
+                *line = i;
+                return r;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/** Apply `PIPOWERD_FAKE_HIGH` to a new request. */
+static void set_initial_values(int r) {
+    const char *spec = getenv("PIPOWERD_FAKE_HIGH");
+    int line;
+
+    while (spec && *spec) {
+        const char *colon = strchr(spec, ':'),
+                   *comma = strchr(spec, ',');
+
+        if (colon && (!comma || colon < comma) &&
+                find_line(spec, colon - spec, atoi(colon + 1), &line) == r)
+            values[r] |= 1ULL << line;
+
+        spec = comma ? comma + 1 : NULL;
+    }
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Register a request.
+ *
+ * All requests share the script, so only the first one gets a file
+ * descriptor to poll; the others get -1, which `poll()` ignores.
+ */
+static int fake_request(struct gpio_request *req) {
+    const char *fd = getenv("PIPOWERD_FAKE_FD");
+
+    if (nrequests == FAKE_MAX_REQUESTS)
+        return -ENOSPC;
+
+    requests[nrequests++] = req;
+    set_initial_values(nrequests - 1);
+
+    if (script_fd == -1) {
+        script_fd = fd ? atoi(fd) : 0;
+        fcntl(script_fd, F_SETFL, fcntl(script_fd, F_GETFL) | O_NONBLOCK);
+        req->fd = script_fd;
+    } else {
+        req->fd = -1;
+    }
+
+    return 0;
+}
+
+static int fake_get_values(struct gpio_request *req, uint64_t *bits) {
+    int r;
+
+    for (r = 0; r < nrequests; r++) {
+        if (requests[r] == req) {
+            *bits = values[r];
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+/** Apply one script line, returning 1 if it produced an event. */
+static int apply_line(char *line, struct gpio_event *event) {
+    char *name, *end;
+    unsigned long pin, value;
+    uint64_t bit, timestamp;
+    int r, i;
+
+    name = line + strspn(line, " \t");
+    end = name + strcspn(name, " \t");
+    if (end == name || *end == '\0' || *name == '#')
+        return 0;
+
+    pin = strtoul(end, &end, 10);
+    value = strtoul(end, &end, 10);
+    timestamp = strtoull(end, NULL, 10);
+
+    r = find_line(name, strcspn(name, " \t"), pin, &i);
+    if (r == -1)
+        return 0;
+
+    bit = 1ULL << i;
+    if (!value) {
+        values[r] &= ~bit;
+        return 0;
+    }
+
+    if (values[r] & bit)
+        return 0;
+
+    values[r] |= bit;
+    event->req = requests[r];
+    event->offset = pin;
+    event->timestamp_ns = timestamp ? timestamp : now_ns();
+    return 1;
+}
+
+static int fake_read_events(struct gpio_request *req, struct gpio_event *events, int max) {
+    int n = 0;
+
+    // There is one script for all requests; events name their own.
+    (void)req;
+
+    while (n < max) {
+        char *nl = memchr(buf, '\n', buflen);
+        ssize_t len;
+
+        if (nl) {
+            *nl = '\0';
+            n += apply_line(buf, &events[n]);
+            buflen -= nl + 1 - buf;
+            memmove(buf, nl + 1, buflen);
+            continue;
+        }
+
+        if (eof)
+            break;
+
+        // Discard overlong lines rather than stalling
+        if (buflen == sizeof(buf))
+            buflen = 0;
+
+        len = read(script_fd, buf + buflen, sizeof(buf) - buflen);
+        if (len == -1) {
+            if (errno == EAGAIN || errno == EINTR)
+                break;
+            return -errno;
+        }
+
+        if (len == 0)
+            eof = 1;
+        buflen += len;
+    }
+
+    if (n == 0 && eof)
+        return -ENODATA;
+
+    return n;
+}
+
+const struct gpio_backend gpio_fake_backend = {
+    .name = "fake",
+    .request = fake_request,
+    .get_values = fake_get_values,
+    .read_events = fake_read_events,
+};
@@ -0,0 +1,125 @@
+/**
+ * \file gpio-vbus.c
+ *
+ * GPIO backend on the virtual bus used for co-simulation (see `vbus.h`).
+ *
+ * The bus is the file named by `PIPOWER_VBUS` (default
+ * `VBUS_DEFAULT_PATH`). It has a single set of lines, so the device of a
+ * request is ignored and its offsets are bus line numbers. Event
+ * timestamps, and `now()`, are in virtual time.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stddef.h>
+
+#include "gpio.h"
+#include "vbus.h"
+
+#ifndef VBUS_MAX_REQUESTS
+/** Maximum number of requests the vbus backend can track */
+#define VBUS_MAX_REQUESTS 16
+#endif
+
+static struct vbus_handle bus;
+static struct gpio_request *requests[VBUS_MAX_REQUESTS];
+static int nrequests;
+
+static int open_bus() {
+    return bus.bus ? 0 : vbus_open(&bus, NULL);
+}
+
+/** Register a request.
+ *
+ * As with the fake backend, only the first request gets a file
+ * descriptor to poll, since all requests share one bus.
+ */
+static int bus_request(struct gpio_request *req) {
+    uint64_t lines = 0;
+    unsigned int i;
+    int ret;
+
+    if (nrequests == VBUS_MAX_REQUESTS)
+        return -ENOSPC;
+
+    if ((ret = open_bus()) < 0)
+        return ret;
+
+    for (i = 0; i < req->nlines; i++) {
+        if (req->offsets[i] >= VBUS_MAX_LINES)
+            return -EINVAL;
+        lines |= 1ULL << req->offsets[i];
+    }
+
+    ret = vbus_attach(&bus, lines);
+    if (ret < 0)
+        return ret;
+
+    req->fd = nrequests ? -1 : ret;
+    requests[nrequests++] = req;
+    return 0;
+}
+
+static int bus_get_values(struct gpio_request *req, uint64_t *bits) {
+    uint64_t levels = vbus_levels(&bus);
+    unsigned int i;
+
+    *bits = 0;
+    for (i = 0; i < req->nlines; i++) {
+        if (levels & (1ULL << req->offsets[i]))
+            *bits |= 1ULL << i;
+    }
+
+    return 0;
+}
+
+/** Find the request that includes a line. */
+static struct gpio_request *find_request(unsigned int line) {
+    unsigned int i;
+    int r;
+
+    for (r = 0; r < nrequests; r++) {
+        for (i = 0; i < requests[r]->nlines; i++) {
+            if (requests[r]->offsets[i] == line)
+                return requests[r];
+        }
+    }
+
+    return NULL;
+}
+
+/** Read rising edges. Once they have all been read, we tell the bus that
+ * we are waiting again, so that the driver can let virtual time pass. */
+static int bus_read_events(struct gpio_request *req, struct gpio_event *events, int max) {
+    struct vbus_change ch;
+    int n = 0;
+
+    // All requests share one bus; events name their own.
+    (void)req;
+
+    while (n < max && vbus_read(&bus, &ch)) {
+        if (!ch.value || !(events[n].req = find_request(ch.line)))
+            continue;
+
+        events[n].offset = ch.line;
+        events[n].timestamp_ns = ch.time_ns;
+        n++;
+    }
+
+    if (n < max)
+        vbus_idle(&bus);
+
+    return n;
+}
+
+static uint64_t bus_now() {
+    return open_bus() < 0 ? 0 : vbus_now(&bus);
+}
+
+const struct gpio_backend gpio_vbus_backend = {
+    .name = "vbus",
+    .request = bus_request,
+    .get_values = bus_get_values,
+    .read_events = bus_read_events,
+    .now = bus_now,
+};
@@ -0,0 +1,28 @@
+/**
+ * \file gpio.c
+ *
+ * GPIO backend selection.
+ */
+#include <stddef.h>
+#include <string.h>
+
+#include "gpio.h"
+
+/** All available backends; the first one is the default */
+static const struct gpio_backend *backends[] = {
+    &gpio_chardev_backend,
+    &gpio_fake_backend,
+    &gpio_vbus_backend,
+};
+
+/** Return the backend called `name`, or NULL. */
+const struct gpio_backend *gpio_find_backend(const char *name) {
+    unsigned int i;
+
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (strcmp(backends[i]->name, name) == 0)
+            return backends[i];
+    }
+
+    return NULL;
+}
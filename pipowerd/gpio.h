@@ -0,0 +1,68 @@
+/**
+ * \file gpio.h
+ *
+ * GPIO backends.
+ *
+ * `pipowerd` only needs three things from the GPIO subsystem: a request
+ * for rising edge events on a set of lines, the current value of those
+ * lines, and the events themselves. Backends provide these operations so
+ * that the daemon can run against real hardware (`chardev`), against a
+ * scripted fake (`fake`) or against a simulated controller (`vbus`).
+ */
+#ifndef _gpio_h
+#define _gpio_h
+
+#include <stdint.h>
+
+/** Maximum number of lines in a single request */
+#define GPIO_MAX_LINES 64
+
+/** Rising edge events requested on a set of lines of one device. */
+struct gpio_request {
+    const char *device;                 /**< gpiochip device */
+    unsigned int nlines,                /**< number of lines */
+                 offsets[GPIO_MAX_LINES]; /**< line offsets on `device` */
+    int fd;                             /**< file descriptor to poll, or -1 */
+    void *data;                         /**< caller private data */
+};
+
+/** A rising edge. */
+struct gpio_event {
+    struct gpio_request *req;   /**< request to which the line belongs */
+    unsigned int offset;        /**< line offset on the request's device */
+    uint64_t timestamp_ns;      /**< time of the edge, on the backend's clock */
+};
+
+/** Operations provided by a GPIO backend.
+ *
+ * All operations return a negative errno value on failure.
+ */
+struct gpio_backend {
+    const char *name;       /**< name used to select the backend */
+
+    /** Request rising edge events and set `req->fd`. */
+    int (*request)(struct gpio_request *req);
+
+    /** Read current line values; bit `n` is the value of `offsets[n]`. */
+    int (*get_values)(struct gpio_request *req, uint64_t *bits);
+
+    /** Read up to `max` pending events without blocking.
+     *
+     * Returns the number of events read. Fewer than `max` means that
+     * no more events are pending. Events may belong to any request made
+     * through the same backend.
+     */
+    int (*read_events)(struct gpio_request *req, struct gpio_event *events, int max);
+
+    /** Return the current time on the clock used for event timestamps,
+     * in nanoseconds. NULL means CLOCK_MONOTONIC. */
+    uint64_t (*now)();
+};
+
+extern const struct gpio_backend gpio_chardev_backend;
+extern const struct gpio_backend gpio_fake_backend;
+extern const struct gpio_backend gpio_vbus_backend;
+
+const struct gpio_backend *gpio_find_backend(const char *name);
+
+#endif // _gpio_h
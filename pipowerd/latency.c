@@ -0,0 +1,269 @@
+/**
+ * \file latency.c
+ *
+ * Keep histograms of shutdown latency in a small state file that survives
+ * reboots, and export them in the Prometheus text exposition format
+ * (suitable for the node_exporter textfile collector).
+ *
+ * Everything here works on static buffers with plain `read()` and
+ * `write()` so that nothing is allocated after startup.
+ */
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "latency.h"
+
+/** Where the kernel publishes the id of the current boot */
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+
+/** Size of the buffer used to read and write state and metrics files */
+#define LATENCY_BUFSIZE 4096
+
+/** Upper bounds of histogram buckets, in milliseconds (last is `+Inf`) */
+static const uint64_t bucket_bounds_ms[LATENCY_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 15000, 20000, 30000, 60000,
+};
+
+static char buf[LATENCY_BUFSIZE];
+
+/** Return the current CLOCK_MONOTONIC time in nanoseconds. */
+uint64_t latency_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Read the current boot id into `dst`.
+ *
+ * CLOCK_MONOTONIC timestamps are only comparable within a single boot,
+ * so pending edges are tagged with the boot id.
+ */
+int latency_boot_id(char *dst, size_t len) {
+    int fd;
+    ssize_t n;
+
+    fd = open(BOOT_ID_PATH, O_RDONLY);
+    if (fd == -1)
+        return -errno;
+
+    n = read(fd, dst, len - 1);
+    close(fd);
+    if (n == -1)
+        return -errno;
+
+    dst[n] = '\0';
+    dst[strcspn(dst, "\n")] = '\0';
+    return 0;
+}
+
+/** Add an observation of `ns` nanoseconds to a histogram. */
+void latency_observe(struct histogram *hist, uint64_t ns) {
+    uint64_t ms = ns / 1000000;
+    int i;
+
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        if (ms <= bucket_bounds_ms[i])
+            break;
+    }
+
+    hist->buckets[i]++;
+    hist->count++;
+    hist->sum_ms += ms;
+}
+
+/** Write `len` bytes of `data` to `path` atomically.
+ *
+ * The data is written to a temporary file which is then renamed over
+ * `path`, so readers never see a partial file. The temporary file is
+ * named after our pid, so that two writers never share one.
+ */
+static int write_file(const char *path, const char *data, size_t len) {
+    char tmp[PATH_MAX];
+    ssize_t n;
+    int fd, ret = 0;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path,
+                (long)getpid()) >= (int)sizeof(tmp))
+        return -ENAMETOOLONG;
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return -errno;
+
+    n = write(fd, data, len);
+    if (n != (ssize_t)len)
+        ret = (n == -1) ? -errno : -EIO;
+    if (fsync(fd) == -1 && ret == 0)
+        ret = -errno;
+    close(fd);
+
+    if (ret == 0 && rename(tmp, path) == -1)
+        ret = -errno;
+    if (ret != 0)
+        unlink(tmp);
+
+    return ret;
+}
+
+/** Lock the state file at `path` against other instances.
+ *
+ * The lock is taken on `path.lock` rather than `path` itself, since
+ * `latency_save()` replaces `path`. Hold it from `latency_load()` until
+ * after `latency_save()` so that no update is lost. Returns a descriptor
+ * for `latency_unlock()`, or -errno.
+ */
+int latency_lock(const char *path) {
+    char lock[PATH_MAX];
+    int fd;
+
+    if (snprintf(lock, sizeof(lock), "%s.lock", path) >= (int)sizeof(lock))
+        return -ENAMETOOLONG;
+
+    fd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return -errno;
+
+    while (flock(fd, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            int ret = -errno;
+            close(fd);
+            return ret;
+        }
+    }
+
+    return fd;
+}
+
+/** Release a lock taken by `latency_lock()`. */
+void latency_unlock(int fd) {
+    close(fd);
+}
+
+/** Parse a histogram from the remainder of a state file line. */
+static void parse_histogram(char *line, struct histogram *hist) {
+    char *end;
+    int i;
+
+    hist->count = strtoull(line, &end, 10);
+    hist->sum_ms = strtoull(end, &end, 10);
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+        hist->buckets[i] = strtoull(end, &end, 10);
+}
+
+/** Load latency state from `path`.
+ *
+ * A missing state file is not an error; `state` is simply left empty.
+ */
+int latency_load(const char *path, struct latency_state *state) {
+    char *line, *next;
+    ssize_t n;
+    int fd;
+
+    memset(state, 0, sizeof(*state));
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return (errno == ENOENT) ? 0 : -errno;
+
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n == -1)
+        return -errno;
+    buf[n] = '\0';
+
+    for (line = buf; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+
+        if (strncmp(line, "boot_id ", 8) == 0) {
+            strncpy(state->boot_id, line + 8, sizeof(state->boot_id) - 1);
+        } else if (strncmp(line, "edge_ns ", 8) == 0) {
+            state->edge_ns = strtoull(line + 8, NULL, 10);
+        } else if (strncmp(line, "hook ", 5) == 0) {
+            parse_histogram(line + 5, &state->hook);
+        } else if (strncmp(line, "boot_release ", 13) == 0) {
+            parse_histogram(line + 13, &state->boot_release);
+        }
+    }
+
+    return 0;
+}
+
+/** Format a histogram as a state file line. */
+static int format_histogram(char *dst, size_t len, const char *name,
+        const struct histogram *hist) {
+    int n, i;
+
+    n = snprintf(dst, len, "%s %" PRIu64 " %" PRIu64, name,
+            hist->count, hist->sum_ms);
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+        n += snprintf(dst + n, len - n, " %" PRIu64, hist->buckets[i]);
+    n += snprintf(dst + n, len - n, "\n");
+
+    return n;
+}
+
+/** Save latency state to `path`. */
+int latency_save(const char *path, const struct latency_state *state) {
+    int n;
+
+    n = snprintf(buf, sizeof(buf), "boot_id %s\nedge_ns %" PRIu64 "\n",
+            state->boot_id, state->edge_ns);
+    n += format_histogram(buf + n, sizeof(buf) - n, "hook", &state->hook);
+    n += format_histogram(buf + n, sizeof(buf) - n, "boot_release",
+            &state->boot_release);
+
+    return write_file(path, buf, n);
+}
+
+/** Format a histogram in the Prometheus text exposition format. */
+static int export_histogram(char *dst, size_t len, const char *name,
+        const char *help, const struct histogram *hist) {
+    uint64_t cumulative = 0;
+    int n, i;
+
+    n = snprintf(dst, len, "# HELP %s %s\n# TYPE %s histogram\n",
+            name, help, name);
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        cumulative += hist->buckets[i];
+        n += snprintf(dst + n, len - n, "%s_bucket{le=\"%g\"} %" PRIu64 "\n",
+                name, bucket_bounds_ms[i] / 1000.0, cumulative);
+    }
+    n += snprintf(dst + n, len - n,
+            "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n"
+            "%s_sum %.3f\n"
+            "%s_count %" PRIu64 "\n",
+            name, hist->count,
+            name, hist->sum_ms / 1000.0,
+            name, hist->count);
+
+    return n;
+}
+
+/** Export latency histograms to `path` as a Prometheus textfile. */
+int latency_export(const char *path, const struct latency_state *state) {
+    int n;
+
+    n = export_histogram(buf, sizeof(buf),
+            "pipower_shutdown_hook_seconds",
+            "Time from SHUTDOWN assertion to shutdown command completion.",
+            &state->hook);
+    n += export_histogram(buf + n, sizeof(buf) - n,
+            "pipower_shutdown_boot_release_seconds",
+            "Time from SHUTDOWN assertion to BOOT release.",
+            &state->boot_release);
+
+    return write_file(path, buf, n);
+}
@@ -0,0 +1,40 @@
+/**
+ * \file latency.h
+ *
+ * Shutdown latency histograms.
+ */
+#ifndef _latency_h
+#define _latency_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Number of histogram buckets, including the final `+Inf` bucket */
+#define LATENCY_BUCKETS 12
+
+/** A Prometheus-style latency histogram. */
+struct histogram {
+    uint64_t count,                     /**< number of observations */
+             sum_ms,                    /**< sum of all observations */
+             buckets[LATENCY_BUCKETS];  /**< observations per bucket (not cumulative) */
+};
+
+/** Latency state preserved across boots. */
+struct latency_state {
+    char boot_id[40];           /**< boot in which `edge_ns` was recorded */
+    uint64_t edge_ns;           /**< CLOCK_MONOTONIC time of pending SHUTDOWN edge, or 0 */
+
+    struct histogram hook,          /**< SHUTDOWN edge to shutdown command completion */
+                     boot_release;  /**< SHUTDOWN edge to BOOT release */
+};
+
+uint64_t latency_now();
+int latency_boot_id(char *buf, size_t len);
+void latency_observe(struct histogram *hist, uint64_t ns);
+int latency_lock(const char *path);
+void latency_unlock(int fd);
+int latency_load(const char *path, struct latency_state *state);
+int latency_save(const char *path, const struct latency_state *state);
+int latency_export(const char *path, const struct latency_state *state);
+
+#endif // _latency_h
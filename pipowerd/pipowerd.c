@@ -8,17 +8,23 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
-#include <linux/gpio.h>
+#include "gpio.h"
+#include "latency.h"
 
 #ifndef DEFAULT_GPIO_DEV
 /** On which gpio device is our pin of interest? */
@@ -35,24 +41,67 @@
 #define DEFAULT_SHUTDOWN_COMMAND "/bin/systemctl poweroff"
 #endif
 
+#ifndef DEFAULT_RT_PRIORITY
+/** SCHED_FIFO priority used in `--realtime` mode */
+#define DEFAULT_RT_PRIORITY 50
+#endif
+
+#ifndef RT_STACK_PREFAULT
+/** Bytes of stack to touch before locking memory in `--realtime` mode */
+#define RT_STACK_PREFAULT (64 * 1024)
+#endif
+
+#ifndef SCHED_RESET_ON_FORK
+/** Do not let the shutdown command inherit our real-time policy */
+#define SCHED_RESET_ON_FORK 0x40000000
+#endif
+
+#ifndef MAX_BINDINGS
+/** Maximum number of pins we can monitor */
+#define MAX_BINDINGS 64
+#endif
+
+#ifndef MAX_CHIPS
+/** Maximum number of gpio devices we can monitor */
+#define MAX_CHIPS 16
+#endif
+
+/** Number of events to read from a line request at once */
+#define EVENT_BATCH 16
+
 #define OPT_GPIO_DEV 'd'                /**< `--device|-d <device>` */
 #define OPT_PIN 'p'                     /**< `--pin|-p <pin>` */
 #define OPT_SHUTDOWN_COMMAND 'c'        /**< `--shutdown-command|-c <command> ` */
 #define OPT_VERBOSE 'v'                 /**< `--verbose|-v` (may be specified multiple times) */
 #define OPT_IGNORE_INITIAL_STATE 'i'    /**< `--ignore-initial-state|-i` */
+#define OPT_REALTIME 'r'                /**< `--realtime|-r` */
+#define OPT_RT_PRIORITY 'P'             /**< `--rt-priority|-P <priority>` */
+#define OPT_STATE_FILE 's'              /**< `--state-file|-s <path>` */
+#define OPT_METRICS_FILE 'm'            /**< `--metrics-file|-m <path>` */
+#define OPT_MARK_BOOT_RELEASE 'B'       /**< `--mark-boot-release|-B` */
+#define OPT_BIND 'b'                    /**< `--bind|-b <chip>:<pin>:<command>` (may be specified multiple times) */
+#define OPT_GPIO_BACKEND 'G'            /**< `--gpio-backend|-G <backend>` */
 #define OPT_HELP 'h'                    /**< `--help|-h` */
 
 /** Valid single character options */
-#define OPTSTRING "d:p:c:vih"
+#define OPTSTRING "d:p:c:virP:s:m:Bb:G:h"
 
 /** Configure options handling */
 const struct option longopts[] = {
     {"gpio-device", required_argument, 0, OPT_GPIO_DEV},
     {"gpio-pin", required_argument, 0, OPT_PIN},
     {"shutdown-command", required_argument, 0, OPT_SHUTDOWN_COMMAND},
-    {"ignore-initial-state", required_argument, 0, OPT_IGNORE_INITIAL_STATE},
+    {"ignore-initial-state", no_argument, 0, OPT_IGNORE_INITIAL_STATE},
+    {"realtime", no_argument, 0, OPT_REALTIME},
+    {"rt-priority", required_argument, 0, OPT_RT_PRIORITY},
+    {"state-file", required_argument, 0, OPT_STATE_FILE},
+    {"metrics-file", required_argument, 0, OPT_METRICS_FILE},
+    {"mark-boot-release", no_argument, 0, OPT_MARK_BOOT_RELEASE},
+    {"bind", required_argument, 0, OPT_BIND},
+    {"gpio-backend", required_argument, 0, OPT_GPIO_BACKEND},
     {"verbose", no_argument, 0, OPT_VERBOSE},
     {"help", no_argument, 0, OPT_HELP},
+    {0, 0, 0, 0},
 };
 
 /** Holds our global configuration */
@@ -60,110 +109,514 @@ struct config {
     char *device;               /**< path to gpiochip device */
 
     int pin,                    /**< pin to monitor for shutdown events */
-        verbose;                /**< control how verbose we are */
+        verbose,                /**< control how verbose we are */
+        rt_priority;            /**< SCHED_FIFO priority in realtime mode */
 
-    bool ignore_initial_state;  /**< do not exit if shutdown pin is high at start */
+    bool ignore_initial_state,  /**< do not exit if shutdown pin is high at start */
+         realtime,              /**< lock memory and run with SCHED_FIFO */
+         mark_boot_release;     /**< record BOOT release and exit */
 
-    char *shutdown_command;     /**< command to run when we receive a shutdown request */
+    char *shutdown_command,     /**< command to run when we receive a shutdown request */
+         *state_file,           /**< where to keep latency histograms */
+         *metrics_file;         /**< where to export latency histograms */
 } config;
 
+/** A pin to monitor and what to do when it goes high */
+struct binding {
+    char *device;       /**< path to gpiochip device */
+    int pin;            /**< line offset on `device` */
+    char *command;      /**< command to run on a rising edge */
+    bool primary;       /**< this is our own shutdown request */
+};
+
+/** A single line request covering every monitored pin on one gpiochip */
+struct chip {
+    struct gpio_request req;                    /**< line request */
+    struct binding *lines[GPIO_MAX_LINES];      /**< bindings, in request order */
+};
+
+struct binding bindings[MAX_BINDINGS];  /**< All pins we monitor */
+int nbindings;                          /**< Number of entries in `bindings` */
+struct chip chips[MAX_CHIPS];           /**< Line requests, one per gpiochip */
+int nchips;                             /**< Number of entries in `chips` */
+int nchildren;                          /**< Background commands still running */
+const struct gpio_backend *gpio;        /**< How we talk to the GPIO subsystem */
+
+/** Latency histograms, loaded from `config.state_file` at startup */
+struct latency_state latency;
+
+/** Return the current time on the clock used for event timestamps. */
+uint64_t event_clock() {
+    return gpio->now ? gpio->now() : latency_now();
+}
+
 /** Initialize global configuration with default values */
 void init_config() {
     config.device = DEFAULT_GPIO_DEV;
     config.pin = DEFAULT_PIN;
     config.verbose = 0;
+    config.rt_priority = DEFAULT_RT_PRIORITY;
     config.shutdown_command = DEFAULT_SHUTDOWN_COMMAND;
+    gpio = &gpio_chardev_backend;
 }
 
 /** Display a usage message */
 void usage(FILE *out) {
     fprintf(out, "pipower: usage: pipower [-d <device>] [-p <pin>] "
-                 "[-c <shutdown_command> ] [-vi]\n");
+                 "[-c <shutdown_command> ] [-P <priority>]\n"
+                 "       [-s <state_file>] [-m <metrics_file>] [-b <chip>:<pin>:<command> ...]\n"
+                 "       [-G <backend>] [-virB]\n");
 }
 
-/** Loop until we detect a shutdown request.
+/** Touch the stack so that it is resident before we lock memory.
  *
- * First check the initial state of the shutdown pin. If a shutdown
- * request has been asserted, exit immediately unless
- * `--ignore-initial-state` was provided.  If there is no active
- * shutdown request, monitor the pin for rising edge events and exit
- * when one is received.
+ * Without this, the first deep call after an edge (for example into
+ * `fork()`) could still take a page fault.
+ */
+void prefault_stack() {
+    volatile char buf[RT_STACK_PREFAULT];
+    long pagesize = sysconf(_SC_PAGESIZE);
+    size_t i;
+
+    if (pagesize <= 0)
+        pagesize = 4096;
+
+    // Write through the volatile array so that the stores are not
+    // optimised away.
+    for (i = 0; i < sizeof(buf); i += pagesize)
+        buf[i] = 0;
+}
+
+/** Enter real-time mode.
+ *
+ * Lock all current and future pages into memory so that nothing we need
+ * to react to a shutdown request can be swapped out, and switch to the
+ * `SCHED_FIFO` scheduling policy so that we are not starved by a busy
+ * system. The policy is reset on fork, so the shutdown command runs at
+ * normal priority. Failures are reported but are not fatal: a daemon
+ * running without real-time guarantees is better than no daemon at all.
+ */
+void enable_realtime() {
+    struct sched_param param;
+
+    prefault_stack();
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        fprintf(stderr, "pipower: failed to lock memory: %s\n",
+                strerror(errno));
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = config.rt_priority;
+    if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &param) == -1) {
+        fprintf(stderr, "pipower: failed to set SCHED_FIFO priority %d: %s\n",
+                config.rt_priority, strerror(errno));
+    } else if (config.verbose > 0) {
+        fprintf(stderr, "pipower: running with SCHED_FIFO priority %d\n",
+                config.rt_priority);
+    }
+}
+
+/** Add a pin to monitor.
+ *
+ * `primary` marks our own SHUTDOWN line: when it fires we run `command`,
+ * wait for it to complete and exit. Other bindings run their command in
+ * the background and monitoring continues.
  */
-void monitor_shutdown_pin() {
-    struct gpioevent_request req;
-    struct gpiohandle_data data;
-    int fd;
+void add_binding(char *device, int pin, char *command, bool primary) {
+    struct binding *binding;
+    int i;
+
+    for (i = 0; i < nbindings; i++) {
+        if (bindings[i].pin == pin && strcmp(bindings[i].device, device) == 0) {
+            fprintf(stderr, "pipower: %s pin %d is bound more than once\n",
+                    device, pin);
+            exit(1);
+        }
+    }
+
+    if (nbindings == MAX_BINDINGS) {
+        fprintf(stderr, "pipower: too many bindings (max %d)\n", MAX_BINDINGS);
+        exit(1);
+    }
+
+    binding = &bindings[nbindings++];
+    binding->device = device;
+    binding->pin = pin;
+    binding->command = command;
+    binding->primary = primary;
+}
+
+/** Return the path of a gpio device. A name without a `/` is looked
+ * for in `/dev`. */
+char *device_path(const char *name) {
+    char *path;
+
+    if (strchr(name, '/'))
+        return strdup(name);
+
+    path = malloc(strlen(name) + sizeof("/dev/"));
+    sprintf(path, "/dev/%s", name);
+    return path;
+}
+
+/** Parse a line offset, returning -1 if it is not a valid one. */
+int parse_pin(const char *arg) {
+    char *end;
+    long pin;
+
+    errno = 0;
+    pin = strtol(arg, &end, 10);
+    if (errno || end == arg || *end || pin < 0 || pin > INT_MAX)
+        return -1;
+
+    return pin;
+}
+
+/** Parse a `<chip>:<pin>:<command>` binding. */
+void parse_binding(char *spec) {
+    char *device, *pin, *command;
+    int offset;
+
+    device = strdup(spec);
+    pin = strchr(device, ':');
+    command = pin ? strchr(pin + 1, ':') : NULL;
+    if (!command || !*(command + 1)) {
+        fprintf(stderr, "pipower: invalid binding (want <chip>:<pin>:<command>): %s\n", spec);
+        exit(1);
+    }
+
+    *pin++ = '\0';
+    *command++ = '\0';
+
+    offset = parse_pin(pin);
+    if (offset < 0) {
+        fprintf(stderr, "pipower: invalid pin in binding: %s\n", spec);
+        exit(1);
+    }
+
+    add_binding(device_path(device), offset, command, false);
+}
+
+/** Group bindings by gpiochip so that we need only one line request per chip. */
+void group_bindings() {
+    int i, j;
+
+    for (i = 0; i < nbindings; i++) {
+        struct chip *chip = NULL;
+
+        for (j = 0; j < nchips; j++) {
+            if (strcmp(chips[j].req.device, bindings[i].device) == 0) {
+                chip = &chips[j];
+                break;
+            }
+        }
+
+        if (!chip) {
+            if (nchips == MAX_CHIPS) {
+                fprintf(stderr, "pipower: too many gpio devices (max %d)\n", MAX_CHIPS);
+                exit(1);
+            }
+            chip = &chips[nchips++];
+            chip->req.device = bindings[i].device;
+            chip->req.data = chip;
+        }
+
+        if (chip->req.nlines == GPIO_MAX_LINES) {
+            fprintf(stderr, "pipower: too many pins on %s (max %d)\n",
+                    chip->req.device, GPIO_MAX_LINES);
+            exit(1);
+        }
+        chip->lines[chip->req.nlines] = &bindings[i];
+        chip->req.offsets[chip->req.nlines++] = bindings[i].pin;
+    }
+}
+
+/** Request rising edge events for every bound pin on a chip. */
+void request_lines(struct chip *chip) {
     int ret;
 
-    fd = open(config.device, 0);
-    if (fd == -1) {
-        ret = -errno;
-        fprintf(stderr, "pipower: failed to open %s: %s\n",
-                config.device, strerror(errno));
+    ret = gpio->request(&chip->req);
+    if (ret < 0) {
+        fprintf(stderr, "pipower: failed to request lines on %s: %s\n",
+                chip->req.device, strerror(-ret));
         exit(ret);
     }
+}
 
-    req.lineoffset = config.pin;
-    req.handleflags = 0;
-    req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
-    strcpy(req.consumer_label, "pipower-shutdown");
+/** Start a shell command, returning its pid or -1. */
+pid_t start_command(const char *command) {
+    pid_t pid;
 
-    // Request an file descriptor for monitor events and
-    // set the line label
-    ret = ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req);
-    if (ret == -1) {
-        ret = -errno;
-        fprintf(stderr, "pipower: failed to GET_LINEEVENT: %s\n",
-                strerror(errno));
-        exit(ret);
+    pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "pipower: failed to fork: %s\n", strerror(errno));
+        return -1;
     }
 
-    /* Get current value of pin */
-    ret = ioctl(req.fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data);
-    if (ret == -1) {
-        ret = -errno;
-        fprintf(stderr, "pipower: failed to GET_LINE_VALUES: %s\n",
-                strerror(errno));
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+
+    return pid;
+}
+
+/** Run the command for a non-primary binding in the background. */
+void run_action(struct binding *binding) {
+    if (config.verbose > 0)
+        fprintf(stderr, "pipower: received signal on %s pin %d\n",
+                binding->device, binding->pin);
+    if (config.verbose > 1)
+        fprintf(stderr, "pipower: running command: %s\n", binding->command);
+
+    if (start_command(binding->command) != -1)
+        nchildren++;
+}
+
+/** Collect exited background commands. */
+void reap_children() {
+    while (nchildren > 0 && waitpid(-1, NULL, WNOHANG) > 0)
+        nchildren--;
+}
+
+/** Handle a pin that is active when we start or that has seen a rising edge.
+ *
+ * Returns true if this was our own shutdown request.
+ */
+bool handle_active(struct binding *binding) {
+    if (binding->primary)
+        return true;
+
+    run_action(binding);
+    return false;
+}
+
+/** Check for shutdown requests that are already active at startup.
+ *
+ * Returns true if our own shutdown request is active.
+ */
+bool check_initial_state(struct chip *chip) {
+    uint64_t values;
+    unsigned int i;
+    int ret;
+
+    /* Get current value of pins */
+    ret = gpio->get_values(&chip->req, &values);
+    if (ret < 0) {
+        fprintf(stderr, "pipower: failed to get values on %s: %s\n",
+                chip->req.device, strerror(-ret));
         exit(ret);
     }
 
-    if (data.values[0]) {
+    for (i = 0; i < chip->req.nlines; i++) {
+        struct binding *binding = chip->lines[i];
+
+        if (!(values & (1ULL << i)))
+            continue;
+
         if (config.ignore_initial_state) {
             if (config.verbose > 0)
-                fprintf(stderr, "pipower: ignoring active shutdown request\n");
-
+                fprintf(stderr, "pipower: ignoring active request on %s pin %d\n",
+                        binding->device, binding->pin);
         } else {
-            fprintf(stderr, "pipower: shutdown request is already active\n");
-            return;
+            fprintf(stderr, "pipower: request on %s pin %d is already active\n",
+                    binding->device, binding->pin);
+            if (handle_active(binding))
+                return true;
         }
     }
 
-    while (1) {
-        struct gpioevent_data event;
+    return false;
+}
+
+/** Find the binding for a line offset on a chip. */
+struct binding *find_binding(struct chip *chip, unsigned int offset) {
+    unsigned int i;
+
+    for (i = 0; i < chip->req.nlines; i++) {
+        if (chip->lines[i]->pin == (int)offset)
+            return chip->lines[i];
+    }
+
+    return NULL;
+}
+
+/** Loop until we detect a shutdown request.
+ *
+ * First check the initial state of all bound pins. If our own shutdown
+ * request has been asserted, exit immediately unless
+ * `--ignore-initial-state` was provided.  If there is no active
+ * shutdown request, wait for rising edge events on all chips at once
+ * and return when one arrives on the primary pin. Edges on other pins
+ * run their command and monitoring continues.
+ *
+ * Returns the time (in nanoseconds, on the GPIO backend's clock) at
+ * which the shutdown request was asserted.
+ */
+uint64_t monitor_shutdown_pins() {
+    struct pollfd fds[MAX_CHIPS];
+    int i;
+    int ret;
+
+    group_bindings();
 
-        ret = read(req.fd, &event, sizeof(event));
+    for (i = 0; i < nchips; i++) {
+        request_lines(&chips[i]);
+        fds[i].fd = chips[i].req.fd;
+        fds[i].events = POLLIN;
+    }
+
+    for (i = 0; i < nchips; i++) {
+        if (check_initial_state(&chips[i]))
+            return event_clock();
+    }
+
+    while (1) {
+        // Wake up periodically while background commands are running
+        // so that we can collect them.
+        ret = poll(fds, nchips, nchildren ? 1000 : -1);
         if (ret == -1) {
-            if (errno == -EAGAIN) {
+            if (errno == EINTR)
                 continue;
-            } else {
-                ret = -errno;
-                fprintf(stderr, "pipower: failed to read event: %s\n",
-                        strerror(errno));
-                exit(ret);
-            }
+
+            ret = -errno;
+            fprintf(stderr, "pipower: failed to poll: %s\n", strerror(errno));
+            exit(ret);
         }
 
-        if (ret != sizeof(event)) {
-                ret = -EIO;
-                fprintf(stderr, "pipower: failed to read event: %s\n",
-                        strerror(errno));
-                exit(ret);
+        reap_children();
+
+        for (i = 0; i < nchips; i++) {
+            struct gpio_event events[EVENT_BATCH];
+            int n, j;
+
+            // Hang-ups and errors are passed on to read_events(), which
+            // reports them (or end of input) as an error.
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            // Drain all pending events before polling again
+            do {
+                n = gpio->read_events(&chips[i].req, events, EVENT_BATCH);
+                if (n < 0) {
+                    fprintf(stderr, "pipower: failed to read event: %s\n",
+                            strerror(-n));
+                    exit(n);
+                }
+
+                for (j = 0; j < n; j++) {
+                    struct binding *binding = find_binding(events[j].req->data,
+                            events[j].offset);
+
+                    if (binding && handle_active(binding))
+                        return events[j].timestamp_ns;
+                }
+            } while (n == EVENT_BATCH);
         }
+    }
+}
+
+/** Lock and reload latency state, if we are keeping any.
+ *
+ * Another instance (such as `--mark-boot-release`) may have updated the
+ * state file since we last read it, so each update reloads it under the
+ * lock. Returns the lock to pass to `save_latency()`, or -1.
+ */
+int load_latency() {
+    int lock, ret;
+
+    if (!config.state_file)
+        return -1;
+
+    lock = latency_lock(config.state_file);
+    if (lock < 0)
+        fprintf(stderr, "pipower: failed to lock %s: %s\n",
+                config.state_file, strerror(-lock));
+
+    ret = latency_load(config.state_file, &latency);
+    if (ret < 0)
+        fprintf(stderr, "pipower: failed to load %s: %s\n",
+                config.state_file, strerror(-ret));
+
+    return lock;
+}
+
+/** Save and export latency state, if we are keeping any, and release
+ * the lock taken by `load_latency()`. */
+void save_latency(int lock) {
+    int ret;
+
+    if (!config.state_file)
+        return;
+
+    ret = latency_save(config.state_file, &latency);
+    if (ret < 0)
+        fprintf(stderr, "pipower: failed to save %s: %s\n",
+                config.state_file, strerror(-ret));
 
-        // If we get this far we have successfully received a rising
-        // edge event, so exit the loop and return to `main()`.
-        break;
+    if (config.metrics_file) {
+        ret = latency_export(config.metrics_file, &latency);
+        if (ret < 0)
+            fprintf(stderr, "pipower: failed to export %s: %s\n",
+                    config.metrics_file, strerror(-ret));
     }
+
+    if (lock >= 0)
+        latency_unlock(lock);
+}
+
+/** Record the time of the SHUTDOWN edge.
+ *
+ * The edge stays pending in the state file until `--mark-boot-release`
+ * runs later in the same boot.
+ */
+void record_shutdown_edge(uint64_t edge_ns) {
+    int lock = load_latency();
+
+    latency_boot_id(latency.boot_id, sizeof(latency.boot_id));
+    latency.edge_ns = edge_ns;
+    save_latency(lock);
+}
+
+/** Record completion of the shutdown command. */
+void record_hook_complete(uint64_t edge_ns) {
+    uint64_t now = event_clock();
+    int lock = load_latency();
+
+    latency_observe(&latency.hook, now - edge_ns);
+    save_latency(lock);
+
+    if (config.verbose > 0)
+        fprintf(stderr, "pipower: shutdown command completed after %" PRIu64 " ms\n",
+                (now - edge_ns) / 1000000);
+}
+
+/** Record release of the BOOT signal for a pending SHUTDOWN edge.
+ *
+ * This is run from `pipower-boot.service` after it de-asserts BOOT.
+ * Edges recorded during a different boot are discarded, since their
+ * timestamps are not comparable with ours.
+ */
+void record_boot_release() {
+    char boot_id[sizeof(latency.boot_id)];
+    uint64_t now = event_clock();
+    int lock = load_latency();
+
+    if (latency.edge_ns == 0) {
+        if (lock >= 0)
+            latency_unlock(lock);
+        return;
+    }
+
+    if (latency_boot_id(boot_id, sizeof(boot_id)) == 0 &&
+            strcmp(boot_id, latency.boot_id) == 0 &&
+            latency.edge_ns <= now) {
+        latency_observe(&latency.boot_release, now - latency.edge_ns);
+    }
+
+    latency.edge_ns = 0;
+    save_latency(lock);
 }
 
 /** Handle command line options */
@@ -174,12 +627,12 @@ void parse_args(int argc, char *argv[]) {
     while (EOF != (ch = getopt_long(argc, argv, OPTSTRING, longopts, &option_index))) {
         switch (ch) {
             case OPT_GPIO_DEV:
-                config.device = strdup(optarg);
+                config.device = device_path(optarg);
                 break;
 
             case OPT_PIN:
-                config.pin = atoi(optarg);
-                if (config.pin == 0) {
+                config.pin = parse_pin(optarg);
+                if (config.pin < 0) {
                     fprintf(stderr, "pipower: invalid shutdown pin specification: %s\n", optarg);
                     exit(1);
                 }
@@ -193,6 +646,43 @@ void parse_args(int argc, char *argv[]) {
                 config.ignore_initial_state = true;
                 break;
 
+            case OPT_REALTIME:
+                config.realtime = true;
+                break;
+
+            case OPT_RT_PRIORITY:
+                config.rt_priority = atoi(optarg);
+                if (config.rt_priority < sched_get_priority_min(SCHED_FIFO) ||
+                        config.rt_priority > sched_get_priority_max(SCHED_FIFO)) {
+                    fprintf(stderr, "pipower: invalid real-time priority: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case OPT_STATE_FILE:
+                config.state_file = (*optarg) ? strdup(optarg) : NULL;
+                break;
+
+            case OPT_METRICS_FILE:
+                config.metrics_file = (*optarg) ? strdup(optarg) : NULL;
+                break;
+
+            case OPT_MARK_BOOT_RELEASE:
+                config.mark_boot_release = true;
+                break;
+
+            case OPT_BIND:
+                parse_binding(optarg);
+                break;
+
+            case OPT_GPIO_BACKEND:
+                gpio = gpio_find_backend(optarg);
+                if (!gpio) {
+                    fprintf(stderr, "pipower: unknown gpio backend: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+
             case OPT_VERBOSE:
                 config.verbose++;
                 break;
@@ -212,14 +702,27 @@ void parse_args(int argc, char *argv[]) {
 }
 
 int main(int argc, char *argv[]) {
+    uint64_t edge_ns, start_ns;
+    pid_t pid;
+
     init_config();
     parse_args(argc, argv);
 
+    if (config.mark_boot_release) {
+        record_boot_release();
+        return 0;
+    }
+
     if (config.verbose > 0)
-	    fprintf(stderr, "pipower: starting, device=%s pin=%d\n",
-                config.device, config.pin);
+	    fprintf(stderr, "pipower: starting, device=%s pin=%d bindings=%d\n",
+                config.device, config.pin, nbindings);
+
+    add_binding(config.device, config.pin, config.shutdown_command, true);
+
+    if (config.realtime)
+        enable_realtime();
 
-    monitor_shutdown_pin();
+    edge_ns = monitor_shutdown_pins();
 
     if (config.verbose > 0)
 	    fprintf(stderr, "pipower: received shutdown signal\n");
@@ -227,6 +730,22 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "pipower: running shutdown command: %s\n",
                     config.shutdown_command);
 
-    system(config.shutdown_command);
+    // Start the shutdown before recording the edge, since saving the
+    // state file waits for it to reach the disk.
+    start_ns = event_clock();
+    pid = start_command(config.shutdown_command);
+    record_shutdown_edge(edge_ns);
+
+    // bench-latency.sh reads this line
+    if (config.verbose > 0)
+        fprintf(stderr, "pipower: started shutdown command %" PRIu64 " us after the edge\n",
+                (start_ns - edge_ns) / 1000);
+
+    if (pid != -1) {
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+            ;
+        record_hook_complete(edge_ns);
+    }
+
     return 0;
 }
@@ -0,0 +1,455 @@
+/**
+ * \file vbus.c
+ *
+ * Virtual GPIO bus for co-simulation. See `vbus.h`.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vbus.h"
+
+/** Take the bus lock.
+ *
+ * The lock is robust: the driver kills the simulated Pi's processes when
+ * it cuts power, and one of them may be holding it.
+ */
+static void lock(struct vbus *bus) {
+    if (pthread_mutex_lock(&bus->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&bus->lock);
+}
+
+static void unlock(struct vbus *bus) {
+    pthread_mutex_unlock(&bus->lock);
+}
+
+static void set_path(struct vbus_handle *h, const char *path) {
+    if (!path)
+        path = getenv(VBUS_ENV);
+    if (!path || !*path)
+        path = VBUS_DEFAULT_PATH;
+
+    snprintf(h->path, sizeof(h->path), "%s", path);
+}
+
+static void fifo_path(struct vbus_handle *h, pid_t pid, char *buf, size_t len) {
+    snprintf(buf, len, "%s.%ld", h->path, (long)pid);
+}
+
+static int map(struct vbus_handle *h, int fd) {
+    void *p = mmap(NULL, sizeof(struct vbus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+    if (p == MAP_FAILED)
+        return -errno;
+
+    h->bus = p;
+    h->slot = -1;
+    h->fd = -1;
+    return 0;
+}
+
+/** Create a new bus, replacing any existing one at `path`.
+ *
+ * If `path` is NULL, `PIPOWER_VBUS` or `VBUS_DEFAULT_PATH` is used.
+ */
+int vbus_create(struct vbus_handle *h, const char *path) {
+    pthread_mutexattr_t attr;
+    int fd, ret;
+
+    set_path(h, path);
+    unlink(h->path);
+
+    fd = open(h->path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1)
+        return -errno;
+
+    if (ftruncate(fd, sizeof(struct vbus)) == -1) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+
+    if ((ret = map(h, fd)) < 0)
+        return ret;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&h->bus->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    h->bus->version = VBUS_VERSION;
+    h->bus->magic = VBUS_MAGIC;
+    return 0;
+}
+
+/** Open an existing bus. */
+int vbus_open(struct vbus_handle *h, const char *path) {
+    struct stat st;
+    int fd, ret;
+
+    set_path(h, path);
+
+    fd = open(h->path, O_RDWR);
+    if (fd == -1)
+        return -errno;
+
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct vbus)) {
+        close(fd);
+        return -EPROTO;
+    }
+
+    if ((ret = map(h, fd)) < 0)
+        return ret;
+
+    if (h->bus->magic != VBUS_MAGIC || h->bus->version != VBUS_VERSION) {
+        munmap(h->bus, sizeof(struct vbus));
+        return -EPROTO;
+    }
+
+    return 0;
+}
+
+/** Free a client slot. Called with the lock held. */
+static void release(struct vbus_handle *h, int slot) {
+    struct vbus_client *c = &h->bus->clients[slot];
+    char path[sizeof(h->path) + 16];
+
+    if (c->pending)
+        h->bus->busy--;
+
+    fifo_path(h, c->pid, path, sizeof(path));
+    unlink(path);
+    memset(c, 0, sizeof(*c));
+}
+
+/** Give up our client slot and unmap the bus. */
+void vbus_close(struct vbus_handle *h) {
+    if (h->slot >= 0) {
+        lock(h->bus);
+        h->bus->activity++;
+        release(h, h->slot);
+        unlock(h->bus);
+        close(h->fd);
+    }
+
+    munmap(h->bus, sizeof(struct vbus));
+    h->bus = NULL;
+}
+
+/** Wake a client. Called with the lock held. */
+static void wake(struct vbus_handle *h, int slot) {
+    struct vbus_client *c = &h->bus->clients[slot];
+    char path[sizeof(h->path) + 16];
+    int fd;
+
+    if (!c->pending) {
+        c->pending = 1;
+        h->bus->busy++;
+    }
+
+    fifo_path(h, c->pid, path, sizeof(path));
+    fd = open(path, O_WRONLY | O_NONBLOCK);
+    if (fd >= 0) {
+        // A full FIFO already holds a wakeup.
+        if (write(fd, "", 1) == -1 && errno != EAGAIN)
+            release(h, slot);
+        close(fd);
+    } else if (kill(c->pid, 0) == -1 && errno == ESRCH) {
+        release(h, slot);
+    }
+}
+
+/** Become a client, woken by changes on `lines` (a bit mask).
+ *
+ * Calling this again adds to the lines watched. Returns the file
+ * descriptor that becomes readable when we are woken.
+ */
+int vbus_attach(struct vbus_handle *h, uint64_t lines) {
+    char path[sizeof(h->path) + 16];
+    int i;
+
+    if (h->slot >= 0) {
+        lock(h->bus);
+        h->bus->clients[h->slot].lines |= lines;
+        unlock(h->bus);
+        return h->fd;
+    }
+
+    fifo_path(h, getpid(), path, sizeof(path));
+    unlink(path);
+    if (mkfifo(path, 0600) == -1)
+        return -errno;
+
+    // Opening for writing as well means the open does not block, and
+    // the FIFO never reports end of file.
+    h->fd = open(path, O_RDWR | O_NONBLOCK);
+    if (h->fd == -1) {
+        i = -errno;
+        unlink(path);
+        return i;
+    }
+
+    lock(h->bus);
+    for (i = 0; i < VBUS_MAX_CLIENTS; i++) {
+        struct vbus_client *c = &h->bus->clients[i];
+
+        if (c->pid && kill(c->pid, 0) == -1 && errno == ESRCH)
+            release(h, i);
+        if (!c->pid)
+            break;
+    }
+
+    if (i == VBUS_MAX_CLIENTS) {
+        unlock(h->bus);
+        close(h->fd);
+        unlink(path);
+        h->fd = -1;
+        return -ENOSPC;
+    }
+
+    h->slot = i;
+    h->bus->clients[i].pid = getpid();
+    h->bus->clients[i].lines = lines;
+    h->bus->clients[i].cursor = h->bus->head;
+    h->bus->activity++;
+    unlock(h->bus);
+
+    return h->fd;
+}
+
+/** Drive a line, waking the clients watching it. */
+int vbus_set(struct vbus_handle *h, unsigned int line, int value) {
+    struct vbus *bus = h->bus;
+    uint64_t bit = 1ULL << line;
+    int i;
+
+    if (line >= VBUS_MAX_LINES)
+        return -EINVAL;
+
+    lock(bus);
+    bus->activity++;
+
+    if (!!(bus->levels & bit) != !!value) {
+        struct vbus_change *ch = &bus->ring[bus->head % VBUS_RING];
+
+        bus->levels ^= bit;
+        ch->time_ns = bus->time_ns;
+        ch->line = line;
+        ch->value = !!value;
+        bus->head++;
+
+        for (i = 0; i < VBUS_MAX_CLIENTS; i++) {
+            if (bus->clients[i].pid && (bus->clients[i].lines & bit) && i != h->slot)
+                wake(h, i);
+        }
+    }
+
+    unlock(bus);
+    return 0;
+}
+
+/** Return the current line levels; bit `n` is line `n`. */
+uint64_t vbus_levels(struct vbus_handle *h) {
+    uint64_t levels;
+
+    lock(h->bus);
+    levels = h->bus->levels;
+    unlock(h->bus);
+    return levels;
+}
+
+/** Return the virtual time in nanoseconds. */
+uint64_t vbus_now(struct vbus_handle *h) {
+    uint64_t now;
+
+    lock(h->bus);
+    now = h->bus->time_ns;
+    unlock(h->bus);
+    return now;
+}
+
+/** Read the next change on a line we watch.
+ *
+ * Returns 1 if `change` was filled in and 0 if there are none. Changes
+ * that have dropped out of the ring are skipped.
+ */
+int vbus_read(struct vbus_handle *h, struct vbus_change *change) {
+    struct vbus *bus = h->bus;
+    struct vbus_client *c;
+
+    if (h->slot < 0)
+        return 0;
+
+    lock(bus);
+    c = &bus->clients[h->slot];
+    if (bus->head - c->cursor > VBUS_RING)
+        c->cursor = bus->head - VBUS_RING;
+
+    while (c->cursor < bus->head) {
+        struct vbus_change *ch = &bus->ring[c->cursor++ % VBUS_RING];
+
+        if (c->lines & (1ULL << ch->line)) {
+            *change = *ch;
+            unlock(bus);
+            return 1;
+        }
+    }
+
+    unlock(bus);
+    return 0;
+}
+
+/** Drain our FIFO. */
+static void drain(struct vbus_handle *h) {
+    char buf[64];
+
+    while (read(h->fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+/** Report that we are about to wait for the bus again.
+ *
+ * If a change arrived since the last `vbus_read()`, we stay busy and our
+ * FIFO is left readable, so the wait returns at once.
+ */
+void vbus_idle(struct vbus_handle *h) {
+    struct vbus *bus = h->bus;
+    struct vbus_client *c;
+    uint64_t cursor;
+    int unread = 0;
+
+    if (h->slot < 0)
+        return;
+
+    drain(h);
+
+    lock(bus);
+    bus->activity++;
+    c = &bus->clients[h->slot];
+    for (cursor = c->cursor; cursor < bus->head && !unread; cursor++)
+        unread = !!(c->lines & (1ULL << bus->ring[cursor % VBUS_RING].line));
+
+    if (unread) {
+        if (write(h->fd, "", 1) == -1 && errno != EAGAIN)
+            unread = 0;
+    } else if (c->pending) {
+        c->pending = 0;
+        bus->busy--;
+    }
+    unlock(bus);
+}
+
+/** Wait until `ns` of virtual time has passed. */
+int vbus_sleep(struct vbus_handle *h, uint64_t ns) {
+    struct pollfd pfd;
+    int ret, woken = 0;
+
+    if ((ret = vbus_attach(h, 0)) < 0)
+        return ret;
+
+    drain(h);
+
+    lock(h->bus);
+    h->bus->activity++;
+    h->bus->clients[h->slot].wake_ns = h->bus->time_ns + (ns ? ns : 1);
+    if (h->bus->clients[h->slot].pending) {
+        h->bus->clients[h->slot].pending = 0;
+        h->bus->busy--;
+    }
+    unlock(h->bus);
+
+    pfd.fd = h->fd;
+    pfd.events = POLLIN;
+
+    while (!woken) {
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            return -errno;
+
+        drain(h);
+        lock(h->bus);
+        woken = (h->bus->clients[h->slot].wake_ns == 0);
+        unlock(h->bus);
+    }
+
+    return 0;
+}
+
+/** Record whether the simulated Pi has halted. */
+void vbus_set_halted(struct vbus_handle *h, int halted) {
+    lock(h->bus);
+    h->bus->activity++;
+    h->bus->halted = halted;
+    unlock(h->bus);
+}
+
+/** Set the virtual clock (driver only), waking clients whose sleep has
+ * ended. Returns the number woken. */
+int vbus_advance(struct vbus_handle *h, uint64_t time_ns) {
+    struct vbus *bus = h->bus;
+    int i, woken = 0;
+
+    lock(bus);
+    bus->time_ns = time_ns;
+
+    for (i = 0; i < VBUS_MAX_CLIENTS; i++) {
+        struct vbus_client *c = &bus->clients[i];
+
+        if (c->pid && c->wake_ns && c->wake_ns <= time_ns) {
+            c->wake_ns = 0;
+            wake(h, i);
+            woken++;
+        }
+    }
+
+    unlock(bus);
+    return woken;
+}
+
+/** Return the earliest virtual time a client is sleeping until, or 0. */
+uint64_t vbus_next_wake(struct vbus_handle *h) {
+    uint64_t next = 0;
+    int i;
+
+    lock(h->bus);
+    for (i = 0; i < VBUS_MAX_CLIENTS; i++) {
+        uint64_t t = h->bus->clients[i].wake_ns;
+
+        if (h->bus->clients[i].pid && t && (!next || t < next))
+            next = t;
+    }
+    unlock(h->bus);
+
+    return next;
+}
+
+/** Return the number of busy clients (driver only), after freeing the
+ * slots of processes that have exited. `*activity` is set to the
+ * activity count, so that the caller can tell whether anything happened
+ * between two calls. */
+int vbus_busy(struct vbus_handle *h, uint64_t *activity) {
+    struct vbus *bus = h->bus;
+    int i, busy;
+
+    lock(bus);
+    for (i = 0; i < VBUS_MAX_CLIENTS; i++) {
+        if (bus->clients[i].pid && kill(bus->clients[i].pid, 0) == -1 && errno == ESRCH)
+            release(h, i);
+    }
+
+    busy = bus->busy;
+    *activity = bus->activity;
+    unlock(bus);
+
+    return busy;
+}
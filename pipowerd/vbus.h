@@ -0,0 +1,98 @@
+/**
+ * \file vbus.h
+ *
+ * Virtual GPIO bus for co-simulation.
+ *
+ * The bus is a file mapped into memory by every process taking part: the
+ * simulation driver, which runs the controller model and owns the
+ * virtual clock, and the processes standing in for the Pi (`pipowerd`
+ * with the `vbus` backend, and `vbusctl` in scripts). It holds the level
+ * of each line, a ring of recent line changes stamped with virtual time,
+ * and a slot for each process waiting on the bus.
+ *
+ * A waiting process blocks on its own FIFO, `<bus>.<pid>`, which is
+ * written to when a line it watches changes or when the virtual time it
+ * is sleeping until arrives. From then until it next waits it counts as
+ * busy, and the driver does not advance the clock while anything is
+ * busy. Code running between two bus calls therefore takes no virtual
+ * time.
+ */
+#ifndef _vbus_h
+#define _vbus_h
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define VBUS_MAGIC 0x42565050           /**< "PPVB" */
+#define VBUS_VERSION 1                  /**< Layout version */
+#define VBUS_MAX_LINES 64               /**< Lines on the bus */
+#define VBUS_MAX_CLIENTS 32             /**< Processes that can wait at once */
+#define VBUS_RING 256                   /**< Line changes kept for readers */
+
+/** Environment variable naming the bus file */
+#define VBUS_ENV "PIPOWER_VBUS"
+
+#ifndef VBUS_DEFAULT_PATH
+/** Bus file used when `PIPOWER_VBUS` is not set */
+#define VBUS_DEFAULT_PATH "/dev/shm/pipower-vbus"
+#endif
+
+/** A line change. */
+struct vbus_change {
+    uint64_t time_ns;       /**< virtual time of the change */
+    uint32_t line,          /**< line number */
+             value;         /**< new level */
+};
+
+/** A process waiting on the bus. */
+struct vbus_client {
+    pid_t pid;              /**< owner, or 0 if the slot is free */
+    uint64_t lines,         /**< lines whose changes wake it */
+             wake_ns,       /**< virtual time to wake at, or 0 */
+             cursor;        /**< next change in `ring` to read */
+    int pending;            /**< woken and not yet waiting again */
+};
+
+/** The shared bus. */
+struct vbus {
+    uint32_t magic, version;
+    pthread_mutex_t lock;               /**< process-shared, robust */
+
+    uint64_t time_ns,                   /**< virtual clock */
+             levels,                    /**< current line levels */
+             activity,                  /**< bumped by every operation */
+             head;                      /**< line changes written so far */
+    int busy,                           /**< clients woken and not yet waiting */
+        halted;                         /**< the simulated Pi has halted */
+
+    struct vbus_change ring[VBUS_RING];
+    struct vbus_client clients[VBUS_MAX_CLIENTS];
+};
+
+/** A process's connection to the bus. */
+struct vbus_handle {
+    struct vbus *bus;
+    char path[256];         /**< bus file */
+    int slot,               /**< client slot, or -1 */
+        fd;                 /**< read end of our FIFO, or -1 */
+};
+
+int vbus_create(struct vbus_handle *h, const char *path);
+int vbus_open(struct vbus_handle *h, const char *path);
+void vbus_close(struct vbus_handle *h);
+
+int vbus_attach(struct vbus_handle *h, uint64_t lines);
+int vbus_set(struct vbus_handle *h, unsigned int line, int value);
+uint64_t vbus_levels(struct vbus_handle *h);
+uint64_t vbus_now(struct vbus_handle *h);
+int vbus_read(struct vbus_handle *h, struct vbus_change *change);
+void vbus_idle(struct vbus_handle *h);
+int vbus_sleep(struct vbus_handle *h, uint64_t ns);
+void vbus_set_halted(struct vbus_handle *h, int halted);
+
+int vbus_advance(struct vbus_handle *h, uint64_t time_ns);
+uint64_t vbus_next_wake(struct vbus_handle *h);
+int vbus_busy(struct vbus_handle *h, uint64_t *activity);
+
+#endif // _vbus_h
@@ -0,0 +1,126 @@
+/**
+ * \file vbusctl.c
+ *
+ * Act on the virtual GPIO bus from scripts standing in for the Pi during
+ * co-simulation (see `vbus.h`).
+ *
+ * Commands:
+ *
+ * - `get [<line>]`: print a line's level, or all levels as a hex mask
+ * - `set <line> <0|1>`: drive a line
+ * - `sleep <ms>`: wait for `ms` of virtual time
+ * - `now`: print the virtual time in milliseconds
+ * - `halt`: report that the Pi has finished shutting down
+ *
+ * The bus is the file named by `--bus`, `PIPOWER_VBUS` or
+ * `VBUS_DEFAULT_PATH`, in that order.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vbus.h"
+
+#define OPT_BUS 'b'             /**< `--bus|-b <path>` */
+#define OPT_HELP 'h'            /**< `--help|-h` */
+
+#define OPTSTRING "+b:h"
+
+struct option longopts[] = {
+    {"bus", required_argument, 0, OPT_BUS},
+    {"help", no_argument, 0, OPT_HELP},
+    {0, 0, 0, 0},
+};
+
+struct config {
+    char *bus;
+} config;
+
+void usage(FILE *out) {
+    fprintf(out, "vbusctl: usage: vbusctl [-b <bus>] get [<line>]\n"
+                 "       vbusctl [-b <bus>] set <line> <0|1>\n"
+                 "       vbusctl [-b <bus>] sleep <ms>\n"
+                 "       vbusctl [-b <bus>] now|halt\n");
+}
+
+void parse_args(int argc, char *argv[]) {
+    int ch;
+
+    while (EOF != (ch = getopt_long(argc, argv, OPTSTRING, longopts, NULL))) {
+        switch (ch) {
+            case OPT_BUS:
+                config.bus = optarg;
+                break;
+
+            case OPT_HELP:
+                usage(stdout);
+                exit(0);
+
+            default:
+                usage(stderr);
+                exit(2);
+        }
+    }
+
+    if (optind == argc) {
+        usage(stderr);
+        exit(2);
+    }
+}
+
+/** Parse a line number. */
+static unsigned int parse_line(const char *arg) {
+    char *end;
+    unsigned long line = strtoul(arg, &end, 0);
+
+    if (*end || end == arg || line >= VBUS_MAX_LINES) {
+        fprintf(stderr, "vbusctl: invalid line: %s\n", arg);
+        exit(2);
+    }
+
+    return line;
+}
+
+int main(int argc, char *argv[]) {
+    struct vbus_handle h;
+    const char *cmd;
+    char **args;
+    int nargs, ret = 0;
+
+    parse_args(argc, argv);
+    cmd = argv[optind];
+    args = argv + optind + 1;
+    nargs = argc - optind - 1;
+
+    if ((ret = vbus_open(&h, config.bus)) < 0) {
+        fprintf(stderr, "vbusctl: %s: %s\n", h.path, strerror(-ret));
+        return 1;
+    }
+
+    if (strcmp(cmd, "get") == 0 && nargs == 0) {
+        printf("0x%016" PRIx64 "\n", vbus_levels(&h));
+    } else if (strcmp(cmd, "get") == 0 && nargs == 1) {
+        printf("%d\n", (int)(vbus_levels(&h) >> parse_line(args[0]) & 1));
+    } else if (strcmp(cmd, "set") == 0 && nargs == 2) {
+        ret = vbus_set(&h, parse_line(args[0]), atoi(args[1]));
+    } else if (strcmp(cmd, "sleep") == 0 && nargs == 1) {
+        ret = vbus_sleep(&h, strtoull(args[0], NULL, 0) * 1000000);
+    } else if (strcmp(cmd, "now") == 0 && nargs == 0) {
+        printf("%" PRIu64 "\n", vbus_now(&h) / 1000000);
+    } else if (strcmp(cmd, "halt") == 0 && nargs == 0) {
+        vbus_set_halted(&h, 1);
+    } else {
+        usage(stderr);
+        ret = 2;
+    }
+
+    if (ret < 0)
+        fprintf(stderr, "vbusctl: %s: %s\n", cmd, strerror(-ret));
+
+    vbus_close(&h);
+    return ret < 0 ? 1 : ret;
+}
@@ -0,0 +1,16 @@
+/**
+ * \file avr/interrupt.h
+ *
+ * Host stand-in for `<avr/interrupt.h>`. Interrupt handlers become plain
+ * functions, which `model.c` calls when the interrupt would fire.
+ */
+#ifndef _host_avr_interrupt_h
+#define _host_avr_interrupt_h
+
+#define ISR(vector) void vector(void)
+#define EMPTY_INTERRUPT(vector) void vector(void) {}
+
+#define sei()
+#define cli()
+
+#endif // _host_avr_interrupt_h
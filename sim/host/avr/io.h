@@ -0,0 +1,28 @@
+/**
+ * \file avr/io.h
+ *
+ * Host stand-in for `<avr/io.h>`. The ATtiny85 I/O registers used by the
+ * firmware are ordinary variables, defined in `model.c`.
+ */
+#ifndef _host_avr_io_h
+#define _host_avr_io_h
+
+#include <stdint.h>
+
+extern uint8_t DDRB, PORTB, PINB;
+extern uint8_t GIMSK, PCMSK;
+extern uint8_t TCCR0A, TCCR0B, OCR0A, TIMSK;
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+
+#define PCIE 5      /**< GIMSK: pin change interrupt enable */
+#define WGM01 1     /**< TCCR0A: CTC mode */
+#define CS00 0      /**< TCCR0B: clock select */
+#define OCIE0A 4    /**< TIMSK: timer 0 compare match A interrupt enable */
+
+#endif // _host_avr_io_h
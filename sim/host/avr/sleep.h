@@ -0,0 +1,20 @@
+/**
+ * \file avr/sleep.h
+ *
+ * Host stand-in for `<avr/sleep.h>`. `sleep_mode()` returns at once and
+ * tells the model that the MCU is asleep; the model then stops running
+ * `loop()` and the clock until a pin change wakes it.
+ */
+#ifndef _host_avr_sleep_h
+#define _host_avr_sleep_h
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC 1
+#define SLEEP_MODE_PWR_DOWN 2
+
+void model_sleep(void);
+
+#define set_sleep_mode(mode) ((void)(mode))
+#define sleep_mode() model_sleep()
+
+#endif // _host_avr_sleep_h
@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Stand in for the Pi during co-simulation (see cosim.c).
+#
+# cosim starts this when the controller raises EN and kills it when EN
+# drops. It boots, asserts BOOT as pipower-boot.service would, and runs
+# pipowerd on the virtual bus. When SHUTDOWN rises, pipowerd runs
+# `cosim-pi.sh poweroff`, which takes PI_SHUTDOWN_MS to shut down,
+# releases BOOT and marks the release in the state file, and reports
+# that the Pi has halted PI_HALT_MS later.
+#
+# Set PI_RUN_MS to have the Pi shut itself down that long after booting,
+# as `sudo poweroff` would. All times are virtual milliseconds; waits must
+# use `vbusctl sleep`, since a plain `sleep` takes no virtual time.
+
+: ${PI_BOOT_MS:=20000}
+: ${PI_SHUTDOWN_MS:=8000}
+: ${PI_HALT_MS:=2000}
+: ${PI_RUN_MS:=}
+: ${PIN_BOOT:=4}
+: ${PIN_SHUTDOWN:=17}
+: ${PIPOWERD:=pipowerd}
+: ${VBUSCTL:=vbusctl}
+: ${PIPOWER_STATE:=$PIPOWER_VBUS.latency}
+
+export PI_SHUTDOWN_MS PI_HALT_MS PIN_BOOT PIPOWERD VBUSCTL PIPOWER_STATE
+
+if [ "$1" = poweroff ]; then
+    $VBUSCTL sleep $PI_SHUTDOWN_MS
+    $VBUSCTL set $PIN_BOOT 1
+    $PIPOWERD -G vbus --mark-boot-release -s $PIPOWER_STATE
+    $VBUSCTL sleep $PI_HALT_MS
+    exec $VBUSCTL halt
+fi
+
+$VBUSCTL sleep $PI_BOOT_MS
+$VBUSCTL set $PIN_BOOT 0
+
+if [ -n "$PI_RUN_MS" ]; then
+    ($VBUSCTL sleep $PI_RUN_MS && "$0" poweroff) &
+fi
+
+exec $PIPOWERD -G vbus -p $PIN_SHUTDOWN -s $PIPOWER_STATE -c "$0 poweroff &"
@@ -0,0 +1,454 @@
+/**
+ * \file cosim.c
+ *
+ * Co-simulate the controller with a Pi running `pipowerd`.
+ *
+ * The firmware runs in the host model, with its own timers, and owns the
+ * clock of a virtual GPIO bus (see `pipowerd/vbus.h`). Whenever the model
+ * raises `PIN_EN`, the Pi command (by default `cosim-pi.sh`) is started
+ * in a process group of its own, and whenever `PIN_EN` drops, that group
+ * is killed. `PIN_SHUTDOWN` is driven onto the bus and `BOOT` is read
+ * back from it; `BOOT` is pulled high while the Pi is off. USB power and
+ * the power button follow the `--event` options.
+ *
+ * Virtual time stands still while any process on the Pi side is busy:
+ * after every change the driver delivers, it waits until nothing is
+ * busy and the bus has been quiet for `--settle` of real time. Work done
+ * between bus calls therefore takes no virtual time, and only
+ * `vbusctl sleep` lets it pass; a plain `sleep` on the Pi side is free.
+ *
+ * The run ends when `PIN_EN` drops for the first time, or after
+ * `--time`. One line of `key=value` pairs is then printed, with the
+ * virtual time in milliseconds of each step of the power-off handshake
+ * (`-` if it did not happen) and whether power was cut before the Pi
+ * had halted.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "model.h"
+#include "state_names.h"
+#include "vbus.h"
+
+#ifndef MAX_EVENTS
+#define MAX_EVENTS 64           /**< Number of `--event` options accepted */
+#endif
+
+#ifndef DEFAULT_TIME_MS
+#define DEFAULT_TIME_MS 600000  /**< Virtual time limit */
+#endif
+
+#ifndef DEFAULT_SETTLE_US
+#define DEFAULT_SETTLE_US 10000 /**< Real time the bus must be quiet for */
+#endif
+
+#define NEVER UINT64_MAX
+
+#define OPT_PI 'p'              /**< `--pi|-p <command>` */
+#define OPT_BUS 'b'             /**< `--bus|-b <path>` */
+#define OPT_EVENT 'e'           /**< `--event|-e <ms>:<usb|power>=<0|1>` */
+#define OPT_TIME 'T'            /**< `--time|-T <ms>` */
+#define OPT_SETTLE 'S'          /**< `--settle|-S <us>` */
+#define OPT_SHUTDOWN_LINE 's'   /**< `--shutdown-line|-s <line>` */
+#define OPT_BOOT_LINE 'B'       /**< `--boot-line|-B <line>` */
+#define OPT_VERBOSE 'v'         /**< `--verbose|-v` */
+#define OPT_HELP 'h'            /**< `--help|-h` */
+
+#define OPTSTRING "p:b:e:T:S:s:B:vh"
+
+struct option longopts[] = {
+    {"pi", required_argument, 0, OPT_PI},
+    {"bus", required_argument, 0, OPT_BUS},
+    {"event", required_argument, 0, OPT_EVENT},
+    {"time", required_argument, 0, OPT_TIME},
+    {"settle", required_argument, 0, OPT_SETTLE},
+    {"shutdown-line", required_argument, 0, OPT_SHUTDOWN_LINE},
+    {"boot-line", required_argument, 0, OPT_BOOT_LINE},
+    {"verbose", no_argument, 0, OPT_VERBOSE},
+    {"help", no_argument, 0, OPT_HELP},
+    {0, 0, 0, 0},
+};
+
+/** A scripted change to USB power or the power button. */
+struct event {
+    uint64_t time_ms;
+    uint8_t input;          /**< `MODEL_USB` or `MODEL_POWER` */
+    int level;
+};
+
+struct config {
+    char *pi,
+         *bus;
+    struct event events[MAX_EVENTS];
+    int nevents,
+        verbose;
+    unsigned long time_ms,
+                  settle_us;
+    unsigned int shutdown_line,
+                 boot_line;
+} config = {
+    .pi = "./cosim-pi.sh",
+    .time_ms = DEFAULT_TIME_MS,
+    .settle_us = DEFAULT_SETTLE_US,
+    .shutdown_line = 17,
+    .boot_line = 4,
+};
+
+/** Virtual times of the steps of a session. */
+struct timeline {
+    uint64_t en_on,
+             booted,
+             usb_lost,
+             shutdown,
+             boot_release,
+             halted,
+             en_off;
+} timeline = {NEVER, NEVER, NEVER, NEVER, NEVER, NEVER, NEVER};
+
+struct vbus_handle bus;
+pid_t pi;                   /**< process group of the running Pi, or 0 */
+uint64_t now_ms;            /**< virtual time */
+unsigned long settles;      /**< times we waited for the Pi side */
+
+/** Log a step of the simulation with `--verbose`. */
+static void note(const char *fmt, ...) {
+    va_list ap;
+
+    if (!config.verbose)
+        return;
+
+    fprintf(stderr, "%10llu ms  ", (unsigned long long)now_ms);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+static void mark(uint64_t *when) {
+    if (*when == NEVER)
+        *when = now_ms;
+}
+
+/** Collect exited processes; we are their subreaper, so that processes
+ * orphaned on the Pi side are ours to collect too. */
+static void reap() {
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == pi)
+            note("Pi command exited with status %d", WEXITSTATUS(status));
+    }
+}
+
+/** Wait until nothing on the Pi side is busy and the bus has been quiet
+ * for `config.settle_us`. */
+static void settle() {
+    struct timespec ts = {
+        .tv_sec = config.settle_us / 1000000,
+        .tv_nsec = config.settle_us % 1000000 * 1000,
+    };
+    uint64_t before, after;
+
+    reap();
+    vbus_busy(&bus, &before);
+
+    for (;;) {
+        nanosleep(&ts, NULL);
+        reap();
+        if (vbus_busy(&bus, &after) == 0 && after == before)
+            break;
+        before = after;
+    }
+
+    settles++;
+}
+
+static void start_pi() {
+    pid_t pid;
+
+    vbus_set_halted(&bus, 0);
+
+    pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "cosim: failed to fork: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if (pid == 0) {
+        setpgid(0, 0);
+        execl("/bin/sh", "sh", "-c", config.pi, (char *)NULL);
+        _exit(127);
+    }
+
+    setpgid(pid, pid);
+    pi = pid;
+    note("EN high: starting the Pi");
+}
+
+static void stop_pi() {
+    if (!pi)
+        return;
+
+    kill(-pi, SIGKILL);
+    pi = 0;
+
+    // BOOT is pulled up while the Pi is off.
+    vbus_set(&bus, config.boot_line, 1);
+}
+
+static void parse_event(const char *arg) {
+    struct event *ev = &config.events[config.nevents];
+    char input[16];
+
+    if (config.nevents == MAX_EVENTS) {
+        fprintf(stderr, "cosim: too many events (max %d)\n", MAX_EVENTS);
+        exit(2);
+    }
+
+    if (sscanf(arg, "%llu:%15[a-z]=%d", (unsigned long long *)&ev->time_ms, input,
+                &ev->level) != 3 ||
+            (strcmp(input, "usb") != 0 && strcmp(input, "power") != 0)) {
+        fprintf(stderr, "cosim: invalid event (want <ms>:<usb|power>=<0|1>): %s\n", arg);
+        exit(2);
+    }
+
+    ev->input = strcmp(input, "usb") == 0 ? MODEL_USB : MODEL_POWER;
+    config.nevents++;
+}
+
+void usage(FILE *out) {
+    fprintf(out, "cosim: usage: cosim [-p <command>] [-b <bus>] [-e <ms>:<usb|power>=<0|1> ...]\n"
+                 "                    [-T <ms>] [-S <us>] [-s <line>] [-B <line>] [-v]\n");
+}
+
+static unsigned int parse_line(const char *arg) {
+    unsigned long line = strtoul(arg, NULL, 0);
+
+    if (line >= VBUS_MAX_LINES) {
+        fprintf(stderr, "cosim: invalid line: %s\n", arg);
+        exit(2);
+    }
+
+    return line;
+}
+
+void parse_args(int argc, char *argv[]) {
+    int ch;
+
+    while (EOF != (ch = getopt_long(argc, argv, OPTSTRING, longopts, NULL))) {
+        switch (ch) {
+            case OPT_PI:
+                config.pi = optarg;
+                break;
+
+            case OPT_BUS:
+                config.bus = optarg;
+                break;
+
+            case OPT_EVENT:
+                parse_event(optarg);
+                break;
+
+            case OPT_TIME:
+                config.time_ms = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_SETTLE:
+                config.settle_us = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_SHUTDOWN_LINE:
+                config.shutdown_line = parse_line(optarg);
+                break;
+
+            case OPT_BOOT_LINE:
+                config.boot_line = parse_line(optarg);
+                break;
+
+            case OPT_VERBOSE:
+                config.verbose = 1;
+                break;
+
+            case OPT_HELP:
+                usage(stdout);
+                exit(0);
+
+            default:
+                usage(stderr);
+                exit(2);
+        }
+    }
+
+    if (optind != argc) {
+        usage(stderr);
+        exit(2);
+    }
+}
+
+/** Apply the events due now to `inputs`. */
+static uint8_t apply_events(uint8_t inputs) {
+    int i;
+
+    for (i = 0; i < config.nevents; i++) {
+        struct event *ev = &config.events[i];
+
+        if (ev->time_ms != now_ms)
+            continue;
+
+        inputs = ev->level ? inputs | ev->input : inputs & ~ev->input;
+        note("%s %s", ev->input == MODEL_USB ? "USB" : "power button",
+                ev->input == MODEL_USB ? (ev->level ? "restored" : "lost")
+                                       : (ev->level ? "released" : "pressed"));
+        if (ev->input == MODEL_USB && !ev->level)
+            mark(&timeline.usb_lost);
+    }
+
+    return inputs;
+}
+
+/** React to the firmware's outputs. Returns 1 if the Pi side has
+ * something new to react to. */
+static int drive_outputs(uint8_t before, uint8_t after) {
+    int changed = 0;
+
+    if ((after & MODEL_EN) && !(before & MODEL_EN)) {
+        mark(&timeline.en_on);
+        start_pi();
+        changed = 1;
+    }
+
+    if ((after ^ before) & MODEL_SHUTDOWN) {
+        note("SHUTDOWN %s", after & MODEL_SHUTDOWN ? "high" : "low");
+        if (after & MODEL_SHUTDOWN)
+            mark(&timeline.shutdown);
+        vbus_set(&bus, config.shutdown_line, !!(after & MODEL_SHUTDOWN));
+        changed = 1;
+    }
+
+    if (!(after & MODEL_EN) && (before & MODEL_EN)) {
+        note("EN low: power cut%s", bus.bus->halted ? "" : " before the Pi halted");
+        mark(&timeline.en_off);
+        stop_pi();
+    }
+
+    return changed;
+}
+
+static void print_time(const char *name, uint64_t t) {
+    if (t == NEVER)
+        printf("%s=- ", name);
+    else
+        printf("%s=%llu ", name, (unsigned long long)t);
+}
+
+int main(int argc, char *argv[]) {
+    static struct model m;
+    struct timespec start, end;
+    uint8_t inputs = MODEL_POWER | MODEL_USB | MODEL_BOOT,
+            portb;
+    int ret, deliver, unsafe = 0;
+    char line[16];
+    double real_s;
+
+    parse_args(argc, argv);
+
+    if ((ret = vbus_create(&bus, config.bus)) < 0) {
+        fprintf(stderr, "cosim: %s: %s\n", bus.path, strerror(-ret));
+        return 1;
+    }
+
+    setenv(VBUS_ENV, bus.path, 1);
+    snprintf(line, sizeof(line), "%u", config.boot_line);
+    setenv("PIN_BOOT", line, 1);
+    snprintf(line, sizeof(line), "%u", config.shutdown_line);
+    setenv("PIN_SHUTDOWN", line, 1);
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    vbus_set(&bus, config.boot_line, 1);
+
+    inputs = apply_events(inputs);
+    model_reset(&m, inputs, NULL, NULL);
+    portb = 0;
+
+    for (;;) {
+        uint64_t levels;
+
+        inputs = apply_events(inputs);
+        if (model_set_inputs(&m, inputs, NULL, NULL) < 0)
+            fprintf(stderr, "cosim: loop() did not settle at %llu ms\n",
+                    (unsigned long long)now_ms);
+
+        deliver = drive_outputs(portb, m.portb);
+        portb = m.portb;
+        if (timeline.en_off != NEVER)
+            break;
+
+        if (deliver)
+            settle();
+
+        if (pi && bus.bus->halted && timeline.halted == NEVER) {
+            mark(&timeline.halted);
+            note("Pi halted");
+        }
+
+        // The Pi may have changed BOOT; let the firmware see it before
+        // any time passes.
+        levels = vbus_levels(&bus);
+        if (!!(levels & 1ULL << config.boot_line) != !!(inputs & MODEL_BOOT)) {
+            inputs ^= MODEL_BOOT;
+            note("BOOT %s", inputs & MODEL_BOOT ? "high" : "low");
+            if (!(inputs & MODEL_BOOT))
+                mark(&timeline.booted);
+            else if (timeline.shutdown != NEVER)
+                mark(&timeline.boot_release);
+            continue;
+        }
+
+        if (now_ms >= config.time_ms)
+            break;
+
+        now_ms++;
+        if (vbus_advance(&bus, now_ms * 1000000) > 0)
+            settle();
+        if (model_advance(&m, 1, NULL, NULL) < 0)
+            fprintf(stderr, "cosim: loop() did not settle at %llu ms\n",
+                    (unsigned long long)now_ms);
+    }
+
+    if (timeline.en_off != NEVER && timeline.halted == NEVER && timeline.en_on != NEVER)
+        unsafe = 1;
+
+    stop_pi();
+    reap();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    real_s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    print_time("en_on_ms", timeline.en_on);
+    print_time("booted_ms", timeline.booted);
+    print_time("usb_lost_ms", timeline.usb_lost);
+    print_time("shutdown_ms", timeline.shutdown);
+    print_time("boot_release_ms", timeline.boot_release);
+    print_time("halted_ms", timeline.halted);
+    print_time("en_off_ms", timeline.en_off);
+    printf("unsafe=%d state=%s virtual_s=%.3f real_s=%.3f speedup=%.1f settles=%lu\n",
+            unsafe, state_name(m.state), now_ms / 1000.0, real_s,
+            real_s > 0 ? now_ms / 1000.0 / real_s : 0.0, settles);
+
+    vbus_close(&bus);
+    unlink(bus.path);
+    return unsafe;
+}
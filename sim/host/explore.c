@@ -0,0 +1,945 @@
+/**
+ * \file explore.c
+ *
+ * Explore the controller state machine using the host-compiled model.
+ *
+ * Two strategies are used:
+ *
+ * - An exhaustive breadth-first search. From every reachable model state
+ *   it tries each input edge (or none) followed by no wait, a short wait,
+ *   a wait until the next timer expiry and a wait long enough for any
+ *   power-off to complete. States are deduplicated on `struct model_key`.
+ *   Unless `--bounce` is given, the power button is held for a full
+ *   debounce history (8 polls) after each edge; otherwise the button's
+ *   history alone multiplies the state space by about 200.
+ * - Randomized millisecond-resolution input traces, for timings the
+ *   search does not try.
+ *
+ * These invariants are checked after every pass through `loop()`:
+ *
+ * - `unsafe_cut`: `PIN_EN` never drops while `BOOT` is low unless a timer
+ *   expired, a long press was detected or the controller is unmanaged.
+ * - `shutdown_without_en`: `PIN_SHUTDOWN` is never high while `PIN_EN` is
+ *   low.
+ * - `usb_loss_ignored`: `PIN_EN` does not stay high for longer than the
+ *   USB loss limit after USB is lost, unless unmanaged.
+ * - `deaf_sleep`: the MCU never sleeps unless the power button can wake it.
+ * - `livelock`: `loop()` always settles.
+ * - `bad_state`: `state` is always a valid state.
+ *
+ * The first counterexample found for each invariant is minimized and
+ * printed as a trace that can be replayed with `--replay`. A trace has
+ * one step per line:
+ *
+ *     <POWER> <USB> <BOOT> <wait_ms>
+ *
+ * giving the pin levels to apply and how long to wait afterwards. The
+ * first step gives the levels at power-on. Text after `#` is ignored.
+ *
+ * Invariants named with `--known` are still checked and reported, but
+ * their counterexamples do not make the exit status non-zero. This is
+ * for violations that are understood and waiting on a firmware fix.
+ *
+ * `--transitions` writes every state transition seen, with a count, in
+ * the form `statecheck` reads.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "model.h"
+#include "state_names.h"
+
+#ifndef DEFAULT_RANDOM_MS
+#define DEFAULT_RANDOM_MS 10000000UL    /**< Simulated time for random traces */
+#endif
+
+#ifndef DEFAULT_MAX_STATES
+#define DEFAULT_MAX_STATES 4000000UL    /**< Give up the search after this many states */
+#endif
+
+#define OPT_EXHAUSTIVE 'x'      /**< `--exhaustive|-x` */
+#define OPT_BOUNCE 'b'          /**< `--bounce|-b` */
+#define OPT_RANDOM 'R'          /**< `--random|-R <ms>` */
+#define OPT_DEPTH 'd'           /**< `--depth|-d <steps>` */
+#define OPT_MAX_STATES 'N'      /**< `--max-states|-N <count>` */
+#define OPT_QUANTUM 'q'         /**< `--quantum|-q <ms>` */
+#define OPT_SEED 's'            /**< `--seed|-s <seed>` */
+#define OPT_RUN_LENGTH 'L'      /**< `--run-length|-L <ms>` */
+#define OPT_USB_LIMIT 'u'       /**< `--usb-limit|-u <ms>` */
+#define OPT_OUTPUT 'o'          /**< `--output|-o <dir>` */
+#define OPT_REPLAY 'r'          /**< `--replay|-r <trace>` */
+#define OPT_TRANSITIONS 't'     /**< `--transitions|-t <file>` */
+#define OPT_KNOWN 'k'           /**< `--known|-k <invariant>` */
+#define OPT_HELP 'h'            /**< `--help|-h` */
+
+#define OPTSTRING "xbR:d:N:q:s:L:u:o:r:t:k:h"
+
+const struct option longopts[] = {
+    {"exhaustive", no_argument, 0, OPT_EXHAUSTIVE},
+    {"bounce", no_argument, 0, OPT_BOUNCE},
+    {"random", required_argument, 0, OPT_RANDOM},
+    {"depth", required_argument, 0, OPT_DEPTH},
+    {"max-states", required_argument, 0, OPT_MAX_STATES},
+    {"quantum", required_argument, 0, OPT_QUANTUM},
+    {"seed", required_argument, 0, OPT_SEED},
+    {"run-length", required_argument, 0, OPT_RUN_LENGTH},
+    {"usb-limit", required_argument, 0, OPT_USB_LIMIT},
+    {"output", required_argument, 0, OPT_OUTPUT},
+    {"replay", required_argument, 0, OPT_REPLAY},
+    {"transitions", required_argument, 0, OPT_TRANSITIONS},
+    {"known", required_argument, 0, OPT_KNOWN},
+    {"help", no_argument, 0, OPT_HELP},
+    {0, 0, 0, 0},
+};
+
+struct config {
+    int exhaustive,
+        bounce;
+    unsigned long random_ms,
+                  depth,
+                  max_states,
+                  quantum,
+                  run_length,
+                  usb_limit;
+    uint64_t seed;
+    unsigned int known;         /**< bit `1 << v` for each known violation */
+    char *output,
+         *replay,
+         *transitions;
+} config = {
+    .max_states = DEFAULT_MAX_STATES,
+    .seed = 1,
+};
+
+/** Invariants. */
+enum violation {
+    V_NONE,
+    V_UNSAFE_CUT,
+    V_SHUTDOWN_WITHOUT_EN,
+    V_USB_LOSS_IGNORED,
+    V_DEAF_SLEEP,
+    V_LIVELOCK,
+    V_BAD_STATE,
+    NUM_VIOLATIONS
+};
+
+const struct {
+    const char *name, *description;
+} invariants[NUM_VIOLATIONS] = {
+    [V_UNSAFE_CUT] = {"unsafe_cut",
+        "EN dropped while BOOT was low, without a timeout or long press"},
+    [V_SHUTDOWN_WITHOUT_EN] = {"shutdown_without_en",
+        "SHUTDOWN was high while EN was low"},
+    [V_USB_LOSS_IGNORED] = {"usb_loss_ignored",
+        "EN stayed high too long after USB was lost"},
+    [V_DEAF_SLEEP] = {"deaf_sleep",
+        "went to sleep without the power button as a wake source"},
+    [V_LIVELOCK] = {"livelock",
+        "loop() did not settle"},
+    [V_BAD_STATE] = {"bad_state",
+        "state took an invalid value"},
+};
+
+/** One step of a trace. */
+struct step {
+    uint8_t inputs;
+    unsigned long wait;
+};
+
+/** A sequence of steps, starting at power-on. */
+struct trace {
+    struct step *steps;
+    size_t len, size;
+};
+
+/** A model together with what the invariants need to know about its
+ * history. */
+struct run {
+    struct model m;
+    enum STATE entered_from;        /**< state before the current one */
+    unsigned long usb_lost_ms;      /**< time EN has been high without USB */
+    enum violation violation;       /**< first invariant violated */
+    uint64_t passes;                /**< passes through loop() */
+    unsigned int ignore;            /**< bitmask of invariants not to check */
+    FILE *log;                      /**< if set, log transitions here */
+};
+
+/** First counterexample found for each invariant. */
+struct trace counterexamples[NUM_VIOLATIONS];
+const char *found_by[NUM_VIOLATIONS];
+size_t found_len[NUM_VIOLATIONS];
+
+/** Invariants with a counterexample; exploration carries on past them. */
+unsigned int found_mask;
+
+/** Number of times each state transition was seen. */
+uint64_t transitions[NUM_STATES][NUM_STATES];
+
+uint64_t rng_state;
+
+/** xorshift64* */
+static uint64_t rng() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static unsigned long rng_below(unsigned long n) {
+    return n ? rng() % n : 0;
+}
+
+static double elapsed_since(struct timespec *start) {
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void trace_push(struct trace *t, uint8_t inputs, unsigned long wait) {
+    if (t->len == t->size) {
+        t->size = t->size ? t->size * 2 : 64;
+        t->steps = realloc(t->steps, t->size * sizeof(*t->steps));
+        if (!t->steps) {
+            fprintf(stderr, "explore: out of memory\n");
+            exit(1);
+        }
+    }
+
+    t->steps[t->len].inputs = inputs;
+    t->steps[t->len].wait = wait;
+    t->len++;
+}
+
+static void trace_copy(struct trace *dst, const struct trace *src) {
+    dst->len = 0;
+    for (size_t i = 0; i < src->len; i++)
+        trace_push(dst, src->steps[i].inputs, src->steps[i].wait);
+}
+
+static const char *name_of(enum STATE s) {
+    const char *name = state_name(s);
+
+    return name ? name : "?";
+}
+
+static int unmanaged(enum STATE s) {
+    return s == STATE_UNMANAGED0 || s == STATE_UNMANAGED1 || s == STATE_UNMANAGED2;
+}
+
+static void violate(struct run *r, enum violation v) {
+    if (!r->violation && !(r->ignore & 1<<v)) {
+        r->violation = v;
+        if (r->log)
+            fprintf(r->log, "%10llu ms  violation: %s: %s\n",
+                    (unsigned long long)r->m.time_ms,
+                    invariants[v].name, invariants[v].description);
+    }
+}
+
+static void transition(struct run *r, const struct model *m, enum STATE from, enum STATE to) {
+    if (from < NUM_STATES && to < NUM_STATES)
+        transitions[from][to]++;
+    if (r->log)
+        fprintf(r->log, "%10llu ms  %s -> %s\n", (unsigned long long)m->time_ms,
+                name_of(from), name_of(to));
+}
+
+/** Check the per-pass invariants. */
+static void observe(void *ctx, const struct model *m, const struct model_step *step) {
+    struct run *r = ctx;
+
+    r->passes++;
+
+    if (step->to >= STATE_QUIT)
+        violate(r, V_BAD_STATE);
+
+    if ((step->portb_before & MODEL_EN) && !(step->portb_after & MODEL_EN) &&
+            !(m->inputs & MODEL_BOOT)) {
+        int timeout = (step->from == STATE_POWEROFF2 &&
+                (r->entered_from == STATE_POWEROFF1 || r->entered_from == STATE_BOOTWAIT1));
+
+        if (!(timeout || step->long_press || step->from == STATE_UNMANAGED2))
+            violate(r, V_UNSAFE_CUT);
+    }
+
+    if ((step->portb_after & MODEL_SHUTDOWN) && !(step->portb_after & MODEL_EN))
+        violate(r, V_SHUTDOWN_WITHOUT_EN);
+
+    // A long press assigns `state` before the `switch` runs, so a pass
+    // can make two transitions.
+    if (step->via != step->from)
+        transition(r, m, step->from, step->via);
+    if (step->to != step->via)
+        transition(r, m, step->via, step->to);
+    if (step->from != step->to)
+        r->entered_from = step->from;
+}
+
+static void check_sleep(struct run *r) {
+    if (r->m.asleep && !(r->m.wake_mask & MODEL_POWER))
+        violate(r, V_DEAF_SLEEP);
+}
+
+static void run_reset(struct run *r, uint8_t inputs) {
+    r->entered_from = STATE_START;
+    r->usb_lost_ms = 0;
+    r->violation = V_NONE;
+
+    if (model_reset(&r->m, inputs, observe, r) < 0)
+        violate(r, V_LIVELOCK);
+    check_sleep(r);
+}
+
+/** Apply input levels, then wait. Returns the first violation seen. */
+static enum violation run_step(struct run *r, uint8_t inputs, unsigned long wait) {
+    if (model_set_inputs(&r->m, inputs, observe, r) < 0)
+        violate(r, V_LIVELOCK);
+    check_sleep(r);
+
+    while (wait > 0 && !r->violation) {
+        // Time without USB is counted a millisecond at a time; otherwise
+        // the whole wait can be handed to the model at once.
+        int on_battery = !(r->m.inputs & MODEL_USB) && !r->m.asleep;
+        unsigned long chunk = on_battery ? 1 : wait;
+
+        if (model_advance(&r->m, chunk, observe, r) < 0)
+            violate(r, V_LIVELOCK);
+        wait -= chunk;
+        check_sleep(r);
+
+        if (!(r->m.inputs & MODEL_USB) && (r->m.portb & MODEL_EN) && !unmanaged(r->m.state)) {
+            r->usb_lost_ms += chunk;
+            if (r->usb_lost_ms > config.usb_limit)
+                violate(r, V_USB_LOSS_IGNORED);
+        } else {
+            r->usb_lost_ms = 0;
+        }
+    }
+
+    return r->violation;
+}
+
+/** Replay a trace from power-on. Returns the first violation seen. */
+static enum violation replay(const struct trace *t, FILE *log) {
+    static struct run r;
+    size_t i;
+
+    memset(&r, 0, sizeof(r));
+    r.log = log;
+    run_reset(&r, t->steps[0].inputs);
+    run_step(&r, t->steps[0].inputs, t->steps[0].wait);
+
+    for (i = 1; i < t->len && !r.violation; i++)
+        run_step(&r, t->steps[i].inputs, t->steps[i].wait);
+
+    return r.violation;
+}
+
+/** Shrink a trace while it still violates `v`: drop steps, then shorten
+ * waits, until neither helps. */
+static void minimize(struct trace *t, enum violation v) {
+    struct step saved;
+    int changed = 1;
+    size_t i;
+
+    while (changed) {
+        changed = 0;
+
+        for (i = t->len; i-- > 1;) {
+            saved = t->steps[i];
+            memmove(&t->steps[i], &t->steps[i + 1], (t->len - i - 1) * sizeof(*t->steps));
+            t->len--;
+
+            if (replay(t, NULL) == v) {
+                changed = 1;
+                continue;
+            }
+
+            memmove(&t->steps[i + 1], &t->steps[i], (t->len - i) * sizeof(*t->steps));
+            t->steps[i] = saved;
+            t->len++;
+        }
+
+        for (i = 0; i < t->len; i++) {
+            unsigned long cut;
+
+            for (cut = t->steps[i].wait; cut > 0; cut /= 2) {
+                while (t->steps[i].wait >= cut) {
+                    t->steps[i].wait -= cut;
+                    if (replay(t, NULL) == v) {
+                        changed = 1;
+                        continue;
+                    }
+                    t->steps[i].wait += cut;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/** Record a counterexample if it is the first for its invariant. */
+static void found(enum violation v, const struct trace *t, const char *by) {
+    if (counterexamples[v].len)
+        return;
+
+    trace_copy(&counterexamples[v], t);
+    found_mask |= 1<<v;
+    found_by[v] = by;
+    found_len[v] = t->len;
+    minimize(&counterexamples[v], v);
+}
+
+/** \defgroup Search Exhaustive search
+ * @{
+ */
+
+/** A state reached by the search. */
+struct node {
+    struct model m;
+    uint32_t parent;        /**< index of the node this was reached from */
+    uint8_t inputs;         /**< levels applied to reach it */
+    unsigned long wait;     /**< and the wait after them */
+    unsigned long depth;
+};
+
+struct node *nodes;
+size_t nnodes, nodes_size;
+
+/** Open-addressed hash set of node indices, keyed on `struct model_key`. */
+struct slot {
+    uint32_t hash, index;
+};
+
+struct slot *table;
+size_t table_size;
+
+#define EMPTY UINT32_MAX
+
+static uint32_t hash_key(const struct model_key *key) {
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < sizeof(*key); i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h ^ (h >> 32);
+}
+
+static void table_insert(uint32_t hash, uint32_t index) {
+    size_t i = hash & (table_size - 1);
+
+    while (table[i].index != EMPTY)
+        i = (i + 1) & (table_size - 1);
+    table[i].hash = hash;
+    table[i].index = index;
+}
+
+static void table_grow() {
+    struct slot *old = table;
+    size_t old_size = table_size, i;
+
+    table_size = table_size ? table_size * 2 : 1 << 16;
+    table = malloc(table_size * sizeof(*table));
+    if (!table) {
+        fprintf(stderr, "explore: out of memory\n");
+        exit(1);
+    }
+    memset(table, 0xff, table_size * sizeof(*table));
+
+    for (i = 0; i < old_size; i++) {
+        if (old[i].index != EMPTY)
+            table_insert(old[i].hash, old[i].index);
+    }
+    free(old);
+}
+
+/** Add a node unless an equivalent one has been seen. Returns 1 if it
+ * was added. */
+static int add_node(const struct model *m, uint32_t parent, uint8_t inputs,
+        unsigned long wait, unsigned long depth) {
+    struct model_key key, other;
+    uint32_t hash;
+    size_t i;
+
+    model_key(m, &key);
+    hash = hash_key(&key);
+
+    if (nnodes * 2 >= table_size)
+        table_grow();
+
+    for (i = hash & (table_size - 1); table[i].index != EMPTY; i = (i + 1) & (table_size - 1)) {
+        if (table[i].hash != hash)
+            continue;
+        model_key(&nodes[table[i].index].m, &other);
+        if (memcmp(&key, &other, sizeof(key)) == 0)
+            return 0;
+    }
+
+    if (nnodes == nodes_size) {
+        nodes_size = nodes_size ? nodes_size * 2 : 1 << 16;
+        nodes = realloc(nodes, nodes_size * sizeof(*nodes));
+        if (!nodes) {
+            fprintf(stderr, "explore: out of memory\n");
+            exit(1);
+        }
+    }
+
+    nodes[nnodes] = (struct node){
+        .m = *m, .parent = parent, .inputs = inputs, .wait = wait, .depth = depth,
+    };
+    table[i].hash = hash;
+    table[i].index = nnodes++;
+
+    return 1;
+}
+
+/** Build the trace that reaches a node and then takes one more step. */
+static void path_to(struct trace *t, uint32_t index, uint8_t inputs, unsigned long wait) {
+    size_t n = 0, i;
+
+    t->len = 0;
+    for (i = index; i != EMPTY; i = nodes[i].parent)
+        trace_push(t, nodes[i].inputs, nodes[i].wait);
+    n = t->len;
+
+    for (i = 0; i < n / 2; i++) {
+        struct step tmp = t->steps[i];
+
+        t->steps[i] = t->steps[n - 1 - i];
+        t->steps[n - 1 - i] = tmp;
+    }
+
+    trace_push(t, inputs, wait);
+}
+
+static void explore_exhaustive() {
+    static const uint8_t toggles[] = {0, MODEL_POWER, MODEL_USB, MODEL_BOOT};
+    static struct run r;
+    struct trace t = {0};
+    struct timespec start;
+    uint64_t edges = 0, passes = 0;
+    unsigned long max_depth = 0;
+    uint8_t inputs;
+    size_t next;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (inputs = 0; inputs <= MODEL_INPUTS; inputs++) {
+        if (inputs & ~MODEL_INPUTS)
+            continue;
+
+        r.ignore = found_mask;
+        run_reset(&r, inputs);
+        if (r.violation) {
+            t.len = 0;
+            trace_push(&t, inputs, 0);
+            found(r.violation, &t, "exhaustive search");
+            continue;
+        }
+        add_node(&r.m, EMPTY, inputs, 0, 0);
+    }
+
+    for (next = 0; next < nnodes && nnodes < config.max_states; next++) {
+        unsigned long depth = nodes[next].depth;
+        unsigned int i, j;
+
+        if (config.depth && depth >= config.depth)
+            continue;
+        if (depth > max_depth)
+            max_depth = depth;
+
+        for (i = 0; i < sizeof(toggles) / sizeof(toggles[0]); i++) {
+            unsigned long waits[] = {
+                0,
+                config.quantum,
+                model_next_deadline(&nodes[next].m),
+                config.usb_limit + 1,
+            };
+
+            for (j = 0; j < sizeof(waits) / sizeof(waits[0]); j++) {
+                if ((j == 0 && toggles[i] == 0) || (j == 2 && waits[j] == 0))
+                    continue;
+
+                if (toggles[i] == MODEL_POWER && !config.bounce) {
+                    if (j == 0)
+                        continue;
+                    if (waits[j] < 8 * model_timers.button)
+                        waits[j] = 8 * model_timers.button;
+                }
+
+                r.m = nodes[next].m;
+                r.entered_from = r.m.state;
+                r.usb_lost_ms = 0;
+                r.violation = V_NONE;
+                r.passes = 0;
+                r.ignore = found_mask;
+
+                inputs = r.m.inputs ^ toggles[i];
+                run_step(&r, inputs, waits[j]);
+                edges++;
+                passes += r.passes;
+
+                if (r.violation) {
+                    if (!counterexamples[r.violation].len) {
+                        path_to(&t, next, inputs, waits[j]);
+                        found(r.violation, &t, "exhaustive search");
+                    }
+                    continue;
+                }
+
+                add_node(&r.m, next, inputs, waits[j], depth + 1);
+            }
+        }
+    }
+
+    printf("exhaustive: %zu states, %llu edges, %llu loop() passes, depth %lu%s, %.2f s\n",
+            nnodes, (unsigned long long)edges, (unsigned long long)passes, max_depth,
+            next < nnodes ? " (incomplete)" : "", elapsed_since(&start));
+
+    free(t.steps);
+}
+
+/** @} */
+
+static void explore_random() {
+    static struct run r;
+    struct trace t = {0};
+    struct timespec start;
+    uint64_t simulated = 0, passes = 0, runs = 0;
+    unsigned long long_wait = config.usb_limit > model_timers.long_press ?
+        config.usb_limit : model_timers.long_press;
+    double secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rng_state = config.seed ? config.seed : 1;
+
+    while (simulated < config.random_ms) {
+        // Start with the button released most of the time.
+        uint8_t inputs = rng() & MODEL_INPUTS;
+
+        if (rng_below(8))
+            inputs |= MODEL_POWER;
+
+        t.len = 0;
+        trace_push(&t, inputs, 0);
+        r.passes = 0;
+        r.ignore = found_mask;
+        run_reset(&r, inputs);
+        runs++;
+
+        while (!r.violation && r.m.time_ms < config.run_length) {
+            unsigned long roll = rng_below(10), wait;
+
+            if (roll < 4)
+                inputs ^= MODEL_POWER;
+            else if (roll < 7)
+                inputs ^= MODEL_USB;
+            else
+                inputs ^= MODEL_BOOT;
+
+            roll = rng_below(10);
+            if (roll < 4)
+                wait = rng_below(2 * model_timers.button + 1);
+            else if (roll < 8)
+                wait = rng_below(model_timers.shutdown * 5 / 4 + 1);
+            else
+                wait = rng_below(long_wait * 3 / 2 + 1);
+
+            trace_push(&t, inputs, wait);
+            run_step(&r, inputs, wait);
+        }
+
+        simulated += r.m.time_ms;
+        passes += r.passes;
+
+        if (r.violation)
+            found(r.violation, &t, "random traces");
+    }
+
+    secs = elapsed_since(&start);
+    printf("random: %llu runs, %llu ms simulated, %llu loop() passes, %.2f s (%.1fM ms/s)\n",
+            (unsigned long long)runs, (unsigned long long)simulated,
+            (unsigned long long)passes, secs, secs > 0 ? simulated / secs / 1e6 : 0.0);
+
+    free(t.steps);
+}
+
+/** Print a trace, annotated with the state after each step. */
+static void print_trace(FILE *out, const struct trace *t) {
+    static struct run r;
+    size_t i;
+
+    memset(&r, 0, sizeof(r));
+    fprintf(out, "# POWER USB BOOT wait_ms\n");
+    for (i = 0; i < t->len; i++) {
+        if (i == 0)
+            run_reset(&r, t->steps[0].inputs);
+        run_step(&r, t->steps[i].inputs, t->steps[i].wait);
+
+        fprintf(out, "%d %d %d %lu\t# %s%s EN=%d SHUTDOWN=%d%s\n",
+                !!(t->steps[i].inputs & MODEL_POWER),
+                !!(t->steps[i].inputs & MODEL_USB),
+                !!(t->steps[i].inputs & MODEL_BOOT),
+                t->steps[i].wait, name_of(r.m.state), r.m.asleep ? " (asleep)" : "",
+                !!(r.m.portb & MODEL_EN), !!(r.m.portb & MODEL_SHUTDOWN),
+                r.violation ? " <- violation" : "");
+    }
+}
+
+static int read_trace(const char *path, struct trace *t) {
+    char line[256];
+    FILE *in;
+    int lineno = 0;
+
+    in = fopen(path, "r");
+    if (!in)
+        return -errno;
+
+    while (fgets(line, sizeof(line), in)) {
+        int power, usb, boot;
+        unsigned long wait;
+        char *hash = strchr(line, '#');
+
+        lineno++;
+        if (hash)
+            *hash = '\0';
+        if (strspn(line, " \t\r\n") == strlen(line))
+            continue;
+
+        if (sscanf(line, "%d %d %d %lu", &power, &usb, &boot, &wait) != 4) {
+            fprintf(stderr, "explore: %s:%d: expected <POWER> <USB> <BOOT> <wait_ms>\n",
+                    path, lineno);
+            fclose(in);
+            return -EINVAL;
+        }
+
+        trace_push(t, (power ? MODEL_POWER : 0) | (usb ? MODEL_USB : 0) |
+                (boot ? MODEL_BOOT : 0), wait);
+    }
+
+    fclose(in);
+    return t->len ? 0 : -EINVAL;
+}
+
+/** Write the transitions seen as `<from> -> <to> <count>` lines. */
+static int write_transitions(const char *path) {
+    FILE *out = fopen(path, "w");
+    int from, to;
+
+    if (!out)
+        return -1;
+
+    for (from = 0; from < NUM_STATES; from++) {
+        for (to = 0; to < NUM_STATES; to++) {
+            if (transitions[from][to])
+                fprintf(out, "%s -> %s %llu\n", name_of(from), name_of(to),
+                        (unsigned long long)transitions[from][to]);
+        }
+    }
+
+    return fclose(out);
+}
+
+void usage(FILE *out) {
+    fprintf(out, "explore: usage: explore [-x] [-b] [-R <ms>] [-d <steps>] [-N <states>] [-q <ms>]\n"
+                 "                        [-s <seed>] [-L <ms>] [-u <ms>] [-o <dir>] [-t <file>]\n"
+                 "                        [-k <invariant> ...]\n"
+                 "       explore -r <trace>\n");
+}
+
+/** Look up an invariant by name. */
+static int parse_invariant(const char *name) {
+    int v;
+
+    for (v = V_NONE + 1; v < NUM_VIOLATIONS; v++) {
+        if (strcmp(invariants[v].name, name) == 0)
+            return v;
+    }
+
+    fprintf(stderr, "explore: unknown invariant: %s\n", name);
+    exit(2);
+}
+
+void parse_args(int argc, char *argv[]) {
+    int ch;
+
+    while (EOF != (ch = getopt_long(argc, argv, OPTSTRING, longopts, NULL))) {
+        switch (ch) {
+            case OPT_EXHAUSTIVE:
+                config.exhaustive = 1;
+                break;
+
+            case OPT_BOUNCE:
+                config.bounce = 1;
+                break;
+
+            case OPT_RANDOM:
+                config.random_ms = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_DEPTH:
+                config.depth = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_MAX_STATES:
+                config.max_states = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_QUANTUM:
+                config.quantum = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_SEED:
+                config.seed = strtoull(optarg, NULL, 0);
+                break;
+
+            case OPT_RUN_LENGTH:
+                config.run_length = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_USB_LIMIT:
+                config.usb_limit = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_OUTPUT:
+                config.output = optarg;
+                break;
+
+            case OPT_REPLAY:
+                config.replay = optarg;
+                break;
+
+            case OPT_TRANSITIONS:
+                config.transitions = optarg;
+                break;
+
+            case OPT_KNOWN:
+                config.known |= 1U << parse_invariant(optarg);
+                break;
+
+            case OPT_HELP:
+                usage(stdout);
+                exit(0);
+
+            default:
+                usage(stderr);
+                exit(2);
+        }
+    }
+
+    if (optind != argc) {
+        usage(stderr);
+        exit(2);
+    }
+
+    // Neither strategy chosen: use both.
+    if (!config.exhaustive && !config.random_ms) {
+        config.exhaustive = 1;
+        config.random_ms = DEFAULT_RANDOM_MS;
+    }
+
+    if (!config.quantum)
+        config.quantum = model_timers.button;
+
+    if (!config.usb_limit)
+        config.usb_limit = model_timers.bootwait + model_timers.shutdown +
+            model_timers.poweroff + 10 * model_timers.button;
+
+    if (!config.run_length)
+        config.run_length = 20 * config.usb_limit;
+}
+
+int main(int argc, char *argv[]) {
+    int ret = 0, found = 0, v;
+
+    parse_args(argc, argv);
+
+    if (config.replay) {
+        struct trace t = {0};
+        int err = read_trace(config.replay, &t);
+
+        if (err < 0) {
+            fprintf(stderr, "explore: %s: %s\n", config.replay, strerror(-err));
+            return 2;
+        }
+
+        ret = replay(&t, stdout) != V_NONE;
+        if (config.transitions && write_transitions(config.transitions) < 0) {
+            fprintf(stderr, "explore: %s: %s\n", config.transitions, strerror(errno));
+            ret = 2;
+        }
+        return ret;
+    }
+
+    printf("timers: powerwait %lu, bootwait %lu, shutdown %lu, poweroff %lu, idle %lu, "
+            "long press %lu ms; usb limit %lu ms\n",
+            model_timers.powerwait, model_timers.bootwait, model_timers.shutdown,
+            model_timers.poweroff, model_timers.idle, model_timers.long_press,
+            config.usb_limit);
+
+    if (config.exhaustive)
+        explore_exhaustive();
+    if (config.random_ms)
+        explore_random();
+    if (config.transitions && write_transitions(config.transitions) < 0) {
+        fprintf(stderr, "explore: %s: %s\n", config.transitions, strerror(errno));
+        ret = 2;
+    }
+
+    if (config.output && mkdir(config.output, 0777) == -1 && errno != EEXIST) {
+        fprintf(stderr, "explore: %s: %s\n", config.output, strerror(errno));
+        ret = 2;
+    }
+
+    for (v = V_NONE + 1; v < NUM_VIOLATIONS; v++) {
+        int known = config.known & 1U << v;
+
+        if (!counterexamples[v].len) {
+            if (known)
+                printf("\n%s: known violation not found\n", invariants[v].name);
+            continue;
+        }
+
+        if (!known)
+            ret = 1;
+        found++;
+        printf("\n%s: %s%s\n", invariants[v].name, invariants[v].description,
+                known ? " (known)" : "");
+        printf("found by %s, minimized from %zu to %zu steps:\n",
+                found_by[v], found_len[v], counterexamples[v].len);
+        print_trace(stdout, &counterexamples[v]);
+
+        if (config.output) {
+            char path[4096];
+            FILE *out;
+
+            snprintf(path, sizeof(path), "%s/%s.trace", config.output, invariants[v].name);
+            out = fopen(path, "w");
+            if (!out) {
+                fprintf(stderr, "explore: %s: %s\n", path, strerror(errno));
+                continue;
+            }
+            fprintf(out, "# %s: %s\n", invariants[v].name, invariants[v].description);
+            print_trace(out, &counterexamples[v]);
+            fclose(out);
+        }
+    }
+
+    if (!found)
+        printf("\nno invariant violations found\n");
+
+    return ret;
+}
@@ -0,0 +1,302 @@
+/**
+ * \file model.c
+ *
+ * Host-compiled model of the controller. See `model.h`.
+ *
+ * `pipower.c` is included directly, so its timer macros and globals are
+ * visible here; its `main()` is renamed out of the way.
+ */
+#include <string.h>
+
+#define main pipower_main
+#include "pipower.c"
+#undef main
+
+#include "model.h"
+
+uint8_t DDRB, PORTB, PINB;
+uint8_t GIMSK, PCMSK;
+uint8_t TCCR0A, TCCR0B, OCR0A, TIMSK;
+
+extern volatile unsigned long timer_millis;
+void TIMER0_COMPA_vect(void);
+
+const struct model_timers model_timers = {
+    .powerwait = TIMER_POWERWAIT,
+    .bootwait = TIMER_BOOTWAIT,
+    .shutdown = TIMER_SHUTDOWN,
+    .poweroff = TIMER_POWEROFF,
+    .idle = TIMER_IDLE,
+    .long_press = LONG_PRESS_DURATION,
+    .button = TIMER_BUTTON,
+};
+
+/** Model whose state is currently loaded into the firmware globals. */
+static struct model *current;
+
+/** Called by `sleep_mode()`. */
+void model_sleep(void) {
+    current->asleep = 1;
+    current->sleep_pins = PINB;
+    current->wake_mask = (GIMSK & 1<<PCIE) ? PCMSK : 0;
+}
+
+static void load(struct model *m) {
+    state = m->state;
+    now = m->now;
+    timer_start = m->timer_start;
+    time_pressed = m->time_pressed;
+    timer_millis = m->millis;
+    power_button_state = m->power_button_state;
+    power_button = m->power_button;
+    usb = m->usb;
+    boot = m->boot;
+
+    DDRB = m->ddrb;
+    PORTB = m->portb;
+    PINB = m->pinb;
+    GIMSK = m->gimsk;
+    PCMSK = m->pcmsk;
+    TCCR0A = m->tccr0a;
+    TCCR0B = m->tccr0b;
+    OCR0A = m->ocr0a;
+    TIMSK = m->timsk;
+
+    current = m;
+}
+
+static void store(struct model *m) {
+    m->state = state;
+    m->now = now;
+    m->timer_start = timer_start;
+    m->time_pressed = time_pressed;
+    m->millis = timer_millis;
+    m->power_button_state = power_button_state;
+    m->power_button = power_button;
+    m->usb = usb;
+    m->boot = boot;
+
+    m->ddrb = DDRB;
+    m->portb = PORTB;
+    m->pinb = PINB;
+    m->gimsk = GIMSK;
+    m->pcmsk = PCMSK;
+    m->tccr0a = TCCR0A;
+    m->tccr0b = TCCR0B;
+    m->ocr0a = OCR0A;
+    m->timsk = TIMSK;
+
+    current = NULL;
+}
+
+/** Drive the input pins; output pins read back what is being driven. */
+static inline void update_pins(struct model *m) {
+    PINB = (m->inputs & ~DDRB) | (PORTB & DDRB);
+}
+
+/** Return the state a long press in state `s` forces.
+ *
+ * This mirrors the long-press check at the top of `loop()`, which
+ * assigns `state` before the `switch` runs in the same pass.
+ */
+static enum STATE long_press_state(enum STATE s) {
+    return s == STATE_IDLE2 ? STATE_UNMANAGED0 : STATE_POWEROFF2;
+}
+
+/** Run `loop()` until a pass changes nothing or the MCU goes to sleep. */
+static int settle(struct model *m, model_observer fn, void *ctx) {
+    int pass;
+
+    for (pass = 0; pass < MODEL_MAX_PASSES && !m->asleep; pass++) {
+        struct model_step step = {
+            .from = state,
+            .portb_before = PORTB,
+        };
+        uint8_t history = power_button.history,
+                button_state = power_button_state,
+                gimsk = GIMSK;
+        bool usb_last = usb.last_state,
+             boot_last = boot.last_state;
+
+        update_pins(m);
+        loop();
+
+        step.to = state;
+        step.portb_after = PORTB;
+        step.long_press = (button_state == BUTTON_NORMAL &&
+                power_button_state == BUTTON_IGNORE);
+        step.via = step.long_press ? long_press_state(step.from) : step.from;
+        if (fn)
+            fn(ctx, m, &step);
+
+        if (step.from == step.to && step.portb_before == step.portb_after &&
+                history == power_button.history &&
+                button_state == power_button_state &&
+                usb_last == usb.last_state && boot_last == boot.last_state &&
+                gimsk == GIMSK)
+            return 0;
+    }
+
+    return m->asleep ? 0 : MODEL_LIVELOCK;
+}
+
+/** Apply power with the given input levels, run `setup()` and let
+ * `loop()` settle. */
+int model_reset(struct model *m, uint8_t inputs, model_observer fn, void *ctx) {
+    int ret;
+
+    memset(m, 0, sizeof(*m));
+    m->state = STATE_START;
+    m->power_button_state = BUTTON_NORMAL;
+    m->inputs = inputs & MODEL_INPUTS;
+    m->pinb = m->inputs;
+
+    load(m);
+    quit = false;
+    setup();
+    ret = settle(m, fn, ctx);
+    store(m);
+
+    return ret;
+}
+
+/** Change the input levels, waking the MCU if it is asleep and the
+ * change is on a pin-change interrupt pin, and let `loop()` settle. */
+int model_set_inputs(struct model *m, uint8_t inputs, model_observer fn, void *ctx) {
+    int ret = 0;
+
+    inputs &= MODEL_INPUTS;
+    if (inputs == m->inputs)
+        return 0;
+
+    m->inputs = inputs;
+    if (m->asleep) {
+        if (!((inputs ^ m->sleep_pins) & m->wake_mask))
+            return 0;
+        m->asleep = 0;
+    }
+
+    load(m);
+    PCINT0_vect();
+    ret = settle(m, fn, ctx);
+    store(m);
+
+    return ret;
+}
+
+/** Let `ms` milliseconds pass. The clock stops while the MCU is asleep. */
+int model_advance(struct model *m, unsigned long ms, model_observer fn, void *ctx) {
+    int ret = 0;
+
+    if (m->asleep) {
+        m->time_ms += ms;
+        return 0;
+    }
+
+    load(m);
+    while (ms-- > 0) {
+        m->time_ms++;
+        if ((TIMSK & 1<<OCIE0A) && TCCR0B)
+            TIMER0_COMPA_vect();
+
+        ret = settle(m, fn, ctx);
+        if (ret < 0)
+            break;
+
+        if (m->asleep) {
+            m->time_ms += ms;
+            break;
+        }
+    }
+    store(m);
+
+    return ret;
+}
+
+/** Return the timer tested in a state, or 0 if it tests none.
+ *
+ * This mirrors the `switch` in `loop()`; states not listed either do not
+ * wait or restart `timer_start` before they next test it.
+ */
+static unsigned long state_timer(enum STATE s) {
+    switch (s) {
+        case STATE_POWERWAIT1:
+            return TIMER_POWERWAIT;
+        case STATE_BOOTWAIT1:
+            return TIMER_BOOTWAIT;
+        case STATE_SHUTDOWN1:
+            return TIMER_SHUTDOWN;
+        case STATE_POWEROFF1:
+            return TIMER_POWEROFF;
+        case STATE_IDLE2:
+        case STATE_UNMANAGED2:
+            return TIMER_IDLE;
+        default:
+            return 0;
+    }
+}
+
+/** Return the time until the next timer the firmware is waiting on
+ * expires, or 0 if there is none. */
+unsigned long model_next_deadline(const struct model *m) {
+    unsigned long timer = state_timer(m->state),
+                  elapsed = m->now - m->timer_start,
+                  best = 0;
+
+    if (m->asleep)
+        return 0;
+
+    if (timer > elapsed)
+        best = timer - elapsed;
+
+    // A long press is detected once the button has been down for more
+    // than LONG_PRESS_DURATION.
+    elapsed = m->now - m->time_pressed;
+    if (m->power_button_state == BUTTON_NORMAL && m->power_button.history == 0 &&
+            elapsed <= LONG_PRESS_DURATION &&
+            (!best || LONG_PRESS_DURATION + 1 - elapsed < best))
+        best = LONG_PRESS_DURATION + 1 - elapsed;
+
+    return best;
+}
+
+static inline uint16_t clamp(unsigned long v, unsigned long max) {
+    return v < max ? v : max;
+}
+
+/** Fill in the key of a model.
+ *
+ * Times the firmware will overwrite before reading are left out: the
+ * timer outside states that test it, and the press time while the button
+ * is up, since it cannot read as down again without first being detected
+ * as pressed.
+ */
+void model_key(const struct model *m, struct model_key *key) {
+    unsigned long timer = state_timer(m->state);
+
+    memset(key, 0, sizeof(*key));
+    if (timer && !m->asleep)
+        key->timer_elapsed = clamp(m->now - m->timer_start, timer);
+    if (m->power_button_state == BUTTON_NORMAL && m->power_button.history != 0xff)
+        key->press_elapsed = clamp(m->now - m->time_pressed, LONG_PRESS_DURATION + 1);
+    // Same arithmetic as button_update(); last_poll is only 8 bits wide,
+    // so once `now` passes 255 the button is polled on every pass.
+    key->poll_elapsed = clamp(m->now - m->power_button.last_poll, m->power_button.poll_freq);
+    key->now = clamp(m->now, 256);
+
+    key->state = m->state;
+    key->power_button_state = m->power_button_state;
+    key->history = m->power_button.history;
+    key->usb_state = m->usb.state;
+    key->usb_last = m->usb.last_state;
+    key->boot_state = m->boot.state;
+    key->boot_last = m->boot.last_state;
+    key->portb = m->portb;
+    key->ddrb = m->ddrb;
+    key->gimsk = m->gimsk;
+    key->pcmsk = m->pcmsk;
+    key->inputs = m->inputs;
+    key->asleep = m->asleep;
+    key->sleep_pins = m->sleep_pins;
+    key->wake_mask = m->wake_mask;
+}
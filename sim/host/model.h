@@ -0,0 +1,128 @@
+/**
+ * \file model.h
+ *
+ * Host-compiled model of the controller.
+ *
+ * `model.c` builds the unmodified `pipower.c`, `button.c`, `input.c` and
+ * `millis.c` against stand-in AVR headers, so the state machine can be
+ * run, snapshotted and restored at native speed. Time advances in whole
+ * milliseconds; after every millisecond tick and every input change,
+ * `loop()` is run until it settles, as it would be hundreds of times a
+ * millisecond on the real part.
+ *
+ * There is only one copy of the firmware's globals, so a `struct model`
+ * holds a saved copy of them and each call loads it, runs the firmware
+ * and saves it again. Models can be copied with `memcpy()`.
+ */
+#ifndef _model_h
+#define _model_h
+
+#include <stdint.h>
+
+#include "button.h"
+#include "input.h"
+#include "pins.h"
+#include "states.h"
+
+/** \defgroup ModelInputs Input pin levels
+ *
+ * Inputs are given as the levels on the pins, as they would read in
+ * `PINB`. The power button and `BOOT` are active low.
+ * @{
+ */
+#define MODEL_POWER (1<<PIN_POWER)  /**< High when the button is released */
+#define MODEL_USB (1<<PIN_USB)      /**< High when USB power is present */
+#define MODEL_BOOT (1<<PIN_BOOT)    /**< High until the Pi has booted */
+#define MODEL_INPUTS (MODEL_POWER | MODEL_USB | MODEL_BOOT)
+/** @} */
+
+#define MODEL_EN (1<<PIN_EN)                /**< EN output, in `portb` */
+#define MODEL_SHUTDOWN (1<<PIN_SHUTDOWN)    /**< SHUTDOWN output, in `portb` */
+
+#ifndef MODEL_MAX_PASSES
+#define MODEL_MAX_PASSES 64     /**< Passes through `loop()` before giving up on it settling */
+#endif
+
+#define MODEL_LIVELOCK (-1)     /**< `loop()` did not settle */
+
+/** Saved state of the firmware and its surroundings. */
+struct model {
+    // Firmware globals
+    enum STATE state;
+    unsigned long now,
+                  timer_start,
+                  time_pressed,
+                  millis;
+    uint8_t power_button_state;
+    Button power_button;
+    Input usb, boot;
+
+    // I/O registers
+    uint8_t ddrb, portb, pinb, gimsk, pcmsk, tccr0a, tccr0b, ocr0a, timsk;
+
+    uint8_t inputs;         /**< levels driven onto the input pins */
+    int asleep;             /**< in power-down sleep */
+    uint8_t sleep_pins,     /**< `PINB` when the MCU went to sleep */
+            wake_mask;      /**< pins whose change will wake it */
+    uint64_t time_ms;       /**< time since reset, including time asleep */
+};
+
+/** One pass through `loop()`. */
+struct model_step {
+    enum STATE from,
+               via,         /**< state after the long-press check, before the `switch` */
+               to;
+    uint8_t portb_before,
+            portb_after;
+    int long_press;         /**< the pass detected a long press */
+};
+
+/** Called after every pass through `loop()`.
+ *
+ * Only the `inputs` and `time_ms` members of `m` are up to date while
+ * the firmware is running.
+ */
+typedef void (*model_observer)(void *ctx, const struct model *m, const struct model_step *step);
+
+/** Timer settings the firmware was built with, in milliseconds. */
+struct model_timers {
+    unsigned long powerwait,
+                  bootwait,
+                  shutdown,
+                  poweroff,
+                  idle,
+                  long_press,
+                  button;
+};
+
+extern const struct model_timers model_timers;
+
+/** The parts of a model that determine its future behaviour.
+ *
+ * Elapsed times are clamped where larger values make no difference, so
+ * two models with equal keys behave identically whatever the inputs.
+ */
+struct model_key {
+    uint16_t timer_elapsed,
+             press_elapsed,
+             poll_elapsed,
+             now;
+    uint8_t state,
+            power_button_state,
+            history,
+            usb_state, usb_last,
+            boot_state, boot_last,
+            portb, ddrb, gimsk, pcmsk,
+            inputs,
+            asleep,
+            sleep_pins,
+            wake_mask;
+};
+
+int model_reset(struct model *m, uint8_t inputs, model_observer fn, void *ctx);
+int model_set_inputs(struct model *m, uint8_t inputs, model_observer fn, void *ctx);
+int model_advance(struct model *m, unsigned long ms, model_observer fn, void *ctx);
+unsigned long model_next_deadline(const struct model *m);
+void model_key(const struct model *m, struct model_key *key);
+
+#endif // _model_h
@@ -0,0 +1,494 @@
+/**
+ * \file sweep.c
+ *
+ * Measure what a set of timer settings costs, by running the host model
+ * against recorded Raspberry Pi timings.
+ *
+ * Each trial applies USB power, lets the Pi boot, and then ends the
+ * session in one of three ways: USB power is lost, the power button is
+ * pressed, or the Pi shuts itself down. A simulated Pi reacts to the
+ * controller's outputs:
+ *
+ * - it asserts `BOOT` a boot time after `PIN_EN` goes high;
+ * - it releases `BOOT` a shutdown time after `PIN_SHUTDOWN` goes high
+ *   (or after it decides to shut down on its own);
+ * - it has halted a halt time after that.
+ *
+ * A trial ends when the controller drops `PIN_EN`. The cut is unsafe if
+ * the Pi had not halted. Battery time is wasted while `PIN_EN` is high
+ * without USB power after the Pi has halted.
+ *
+ * Timings are drawn from distributions given as either:
+ *
+ * - a number of seconds, for a constant;
+ * - a file with one sample in seconds per line; or
+ * - a Prometheus metrics file, as `<file>[:<metric>]`, such as the one
+ *   `pipowerd --metrics-file` writes. The histogram named `<metric>`
+ *   (by default `pipower_shutdown_boot_release_seconds`) is sampled
+ *   uniformly within buckets.
+ *
+ * The result is one CSV row per run; `--header` prints the column names.
+ * The timers are those the model was built with, so `sweep.sh` builds one
+ * copy of this program per configuration.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+
+#ifndef MAX_SAMPLES
+#define MAX_SAMPLES 65536       /**< Samples kept from each distribution */
+#endif
+
+#ifndef DEFAULT_METRIC
+#define DEFAULT_METRIC "pipower_shutdown_boot_release_seconds"
+#endif
+
+#ifndef RUN_TIME
+#define RUN_TIME 1000           /**< Time the Pi stays up before shutdown (ms) */
+#endif
+
+#define OPT_BOOT 'b'            /**< `--boot|-b <dist>` */
+#define OPT_SHUTDOWN 'S'        /**< `--shutdown|-S <dist>` */
+#define OPT_HALT 'H'            /**< `--halt|-H <dist>` */
+#define OPT_PRESS 'p'           /**< `--press|-p <dist>` */
+#define OPT_MIX 'm'             /**< `--mix|-m <usb>:<button>:<pi>` */
+#define OPT_TRIALS 'n'          /**< `--trials|-n <count>` */
+#define OPT_SEED 's'            /**< `--seed|-s <seed>` */
+#define OPT_HEADER 'C'          /**< `--header|-C` */
+#define OPT_HELP 'h'            /**< `--help|-h` */
+
+#define OPTSTRING "b:S:H:p:m:n:s:Ch"
+
+const struct option longopts[] = {
+    {"boot", required_argument, 0, OPT_BOOT},
+    {"shutdown", required_argument, 0, OPT_SHUTDOWN},
+    {"halt", required_argument, 0, OPT_HALT},
+    {"press", required_argument, 0, OPT_PRESS},
+    {"mix", required_argument, 0, OPT_MIX},
+    {"trials", required_argument, 0, OPT_TRIALS},
+    {"seed", required_argument, 0, OPT_SEED},
+    {"header", no_argument, 0, OPT_HEADER},
+    {"help", no_argument, 0, OPT_HELP},
+    {0, 0, 0, 0},
+};
+
+/** A distribution of durations. */
+struct dist {
+    const char *source;
+    int histogram;          /**< samples are bucket bounds, with weights */
+    size_t len;
+    double *values,         /**< samples, or bucket upper bounds, in seconds */
+           *weights;        /**< cumulative bucket counts */
+};
+
+/** How a session ends. */
+enum ending {
+    END_USB,                /**< USB power is lost */
+    END_BUTTON,             /**< the power button is pressed */
+    END_PI,                 /**< the Pi shuts itself down */
+    NUM_ENDINGS
+};
+
+struct config {
+    struct dist boot,
+                shutdown,
+                halt,
+                press;
+    unsigned long mix[NUM_ENDINGS];
+    unsigned long trials;
+    uint64_t seed;
+    int header;
+} config = {
+    .mix = {1, 1, 1},
+    .trials = 2000,
+    .seed = 1,
+};
+
+/** Totals over all trials. */
+struct results {
+    unsigned long trials,
+                  unsafe_boot,      /**< power cut while the Pi was booting */
+                  unsafe_shutdown,  /**< power cut while the Pi was shutting down */
+                  unsafe_press,     /**< power cut by an accidental long press */
+                  stuck,            /**< power never cut */
+                  usb_losses;
+    double wasted_s,                /**< battery time after the Pi halted */
+           wasted_max_s;
+} results;
+
+uint64_t rng_state;
+
+/** xorshift64* */
+static uint64_t rng() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double rng_uniform() {
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void dist_push(struct dist *d, double value, double weight) {
+    if (d->len == MAX_SAMPLES)
+        return;
+
+    if (!d->values) {
+        d->values = malloc(MAX_SAMPLES * sizeof(*d->values));
+        d->weights = malloc(MAX_SAMPLES * sizeof(*d->weights));
+        if (!d->values || !d->weights) {
+            fprintf(stderr, "sweep: out of memory\n");
+            exit(1);
+        }
+    }
+
+    d->values[d->len] = value;
+    d->weights[d->len] = weight;
+    d->len++;
+}
+
+/** Load a distribution from a constant, a sample file or a histogram.
+ *
+ * A metrics file may hold several histograms; only the buckets of the
+ * selected metric are read, up to its `+Inf` bucket.
+ */
+static int dist_load(struct dist *d, const char *source) {
+    char path[PATH_MAX], prefix[256], line[256], *end, *colon;
+    const char *metric = DEFAULT_METRIC;
+    double v = strtod(source, &end);
+    int other_buckets = 0, done = 0;
+    FILE *in;
+
+    memset(d, 0, sizeof(*d));
+    d->source = source;
+
+    if (*source && *end == '\0') {
+        dist_push(d, v, 0);
+        return 0;
+    }
+
+    if (strlen(source) >= sizeof(path))
+        return -ENAMETOOLONG;
+    strcpy(path, source);
+    if ((colon = strrchr(path, ':')) && !strchr(colon, '/')) {
+        *colon = '\0';
+        metric = colon + 1;
+    }
+    snprintf(prefix, sizeof(prefix), "%s_bucket{le=\"", metric);
+
+    in = fopen(path, "r");
+    if (!in)
+        return -errno;
+
+    while (!done && fgets(line, sizeof(line), in)) {
+        if (strncmp(line, prefix, strlen(prefix)) == 0) {
+            // <metric>_bucket{le="<bound>"} <cumulative count>
+            char *le = line + strlen(prefix),
+                 *close = strstr(le, "\"}");
+            double bound, count;
+
+            if (!close)
+                continue;
+            done = strncmp(le, "+Inf", 4) == 0;
+            bound = done ? INFINITY : strtod(le, NULL);
+            count = strtod(close + 2, NULL);
+            d->histogram = 1;
+            dist_push(d, bound, count);
+            continue;
+        }
+
+        if (strstr(line, "_bucket{")) {
+            other_buckets = 1;
+            continue;
+        }
+
+        if (line[0] == '#')
+            continue;
+
+        v = strtod(line, &end);
+        if (end != line)
+            dist_push(d, v, 0);
+    }
+
+    fclose(in);
+
+    // A metrics file without the metric we want
+    if (other_buckets && !d->histogram)
+        return -ENODATA;
+
+    if (d->histogram) {
+        // Observations beyond the last finite bound have no upper limit;
+        // count them at that bound.
+        if (d->len > 1 && isinf(d->values[d->len - 1]))
+            d->values[d->len - 1] = d->values[d->len - 2];
+        if (d->len == 0 || d->weights[d->len - 1] <= 0)
+            return -ENODATA;
+    }
+
+    return d->len ? 0 : -ENODATA;
+}
+
+/** Draw a duration in milliseconds. */
+static unsigned long dist_sample(const struct dist *d) {
+    double v;
+
+    if (!d->histogram) {
+        v = d->values[rng() % d->len];
+    } else {
+        double target = rng_uniform() * d->weights[d->len - 1], lower = 0;
+        size_t i;
+
+        for (i = 0; i < d->len - 1 && d->weights[i] <= target; i++)
+            lower = d->values[i];
+        v = lower + rng_uniform() * (d->values[i] - lower);
+    }
+
+    return v > 0 ? (unsigned long)(v * 1000 + 0.5) : 0;
+}
+
+#define NEVER UINT64_MAX
+
+static void waste(uint64_t from, uint64_t until) {
+    double wasted = (until - from) / 1000.0;
+
+    results.wasted_s += wasted;
+    if (wasted > results.wasted_max_s)
+        results.wasted_max_s = wasted;
+}
+
+/** Run one session, from power-on to power-off. */
+static void trial() {
+    static struct model m;
+    unsigned long boot = dist_sample(&config.boot),
+                  shutdown = dist_sample(&config.shutdown),
+                  halt = dist_sample(&config.halt),
+                  press = dist_sample(&config.press),
+                  total = 0, pick;
+    uint64_t booted_at = NEVER,     // when the Pi asserts BOOT
+             end_at = NEVER,        // when the session ends
+             release_at = NEVER,    // when the Pi releases BOOT
+             halted_at = NEVER,     // when the Pi has halted
+             lost_at = NEVER,       // when USB power was lost
+             press_until = NEVER,   // when the button is released
+             horizon, t;
+    uint8_t inputs = MODEL_POWER | MODEL_USB | MODEL_BOOT,
+            outputs, previous;
+    enum ending ending;
+    int i;
+
+    for (i = 0; i < NUM_ENDINGS; i++)
+        total += config.mix[i];
+    pick = rng() % total;
+    for (ending = 0; pick >= config.mix[ending]; ending++)
+        pick -= config.mix[ending];
+
+    // Long enough for the slowest legitimate power-off.
+    horizon = model_timers.powerwait + model_timers.bootwait + boot + RUN_TIME +
+        model_timers.shutdown + model_timers.poweroff + shutdown + halt +
+        press + 10 * 1000;
+
+    model_reset(&m, inputs, NULL, NULL);
+    previous = m.portb;
+    results.trials++;
+
+    for (t = m.time_ms; t < horizon; t = m.time_ms) {
+        // The Pi and the outside world act on the inputs...
+        if (booted_at <= t) {
+            booted_at = NEVER;
+            inputs &= ~MODEL_BOOT;
+            end_at = t + RUN_TIME;
+        }
+
+        if (end_at <= t) {
+            end_at = NEVER;
+            if (ending == END_USB) {
+                inputs &= ~MODEL_USB;
+                lost_at = t;
+                results.usb_losses++;
+            } else if (ending == END_BUTTON) {
+                inputs &= ~MODEL_POWER;
+                press_until = t + press;
+            } else {
+                release_at = t + shutdown;
+            }
+        }
+
+        if (press_until <= t) {
+            press_until = NEVER;
+            inputs |= MODEL_POWER;
+        }
+
+        if (release_at <= t) {
+            release_at = NEVER;
+            inputs |= MODEL_BOOT;
+            halted_at = t + halt;
+        }
+
+        model_set_inputs(&m, inputs, NULL, NULL);
+        outputs = m.portb;
+
+        // ...and reacts to the outputs.
+        if ((outputs & MODEL_EN) && !(previous & MODEL_EN))
+            booted_at = t + boot;
+
+        if ((outputs & MODEL_SHUTDOWN) && !(previous & MODEL_SHUTDOWN) &&
+                !(inputs & MODEL_BOOT) && halted_at == NEVER)
+            release_at = t + shutdown;
+
+        if (!(outputs & MODEL_EN) && (previous & MODEL_EN)) {
+            if (halted_at > t) {
+                if (inputs & MODEL_BOOT && halted_at == NEVER && release_at == NEVER)
+                    results.unsafe_boot++;
+                else if (ending == END_BUTTON && press > model_timers.long_press)
+                    results.unsafe_press++;
+                else
+                    results.unsafe_shutdown++;
+            } else if (lost_at != NEVER) {
+                waste(halted_at > lost_at ? halted_at : lost_at, t);
+            }
+            return;
+        }
+
+        previous = outputs;
+        model_advance(&m, 1, NULL, NULL);
+    }
+
+    results.stuck++;
+    if (lost_at != NEVER && halted_at != NEVER)
+        waste(halted_at > lost_at ? halted_at : lost_at, horizon);
+}
+
+static void parse_mix(const char *arg) {
+    char *end;
+    int i;
+
+    for (i = 0; i < NUM_ENDINGS; i++) {
+        config.mix[i] = strtoul(arg, &end, 10);
+        if (end == arg || (i < NUM_ENDINGS - 1 && *end != ':')) {
+            fprintf(stderr, "sweep: invalid mix (want <usb>:<button>:<pi>): %s\n", arg);
+            exit(2);
+        }
+        arg = end + 1;
+    }
+
+    if (config.mix[END_USB] + config.mix[END_BUTTON] + config.mix[END_PI] == 0) {
+        fprintf(stderr, "sweep: mix must not be all zero\n");
+        exit(2);
+    }
+}
+
+static void load_dist(struct dist *d, const char *source) {
+    int ret = dist_load(d, source);
+
+    if (ret < 0) {
+        fprintf(stderr, "sweep: %s: %s\n", source, strerror(-ret));
+        exit(1);
+    }
+}
+
+void usage(FILE *out) {
+    fprintf(out, "sweep: usage: sweep -b <dist> -S <dist> [-H <dist>] [-p <dist>]\n"
+                 "                    [-m <usb>:<button>:<pi>] [-n <trials>] [-s <seed>] [-C]\n");
+}
+
+void parse_args(int argc, char *argv[]) {
+    const char *boot = NULL, *shutdown = NULL, *halt = "0", *press = "0.2";
+    int ch;
+
+    while (EOF != (ch = getopt_long(argc, argv, OPTSTRING, longopts, NULL))) {
+        switch (ch) {
+            case OPT_BOOT:
+                boot = optarg;
+                break;
+
+            case OPT_SHUTDOWN:
+                shutdown = optarg;
+                break;
+
+            case OPT_HALT:
+                halt = optarg;
+                break;
+
+            case OPT_PRESS:
+                press = optarg;
+                break;
+
+            case OPT_MIX:
+                parse_mix(optarg);
+                break;
+
+            case OPT_TRIALS:
+                config.trials = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_SEED:
+                config.seed = strtoull(optarg, NULL, 0);
+                break;
+
+            case OPT_HEADER:
+                config.header = 1;
+                break;
+
+            case OPT_HELP:
+                usage(stdout);
+                exit(0);
+
+            default:
+                usage(stderr);
+                exit(2);
+        }
+    }
+
+    if (config.header)
+        return;
+
+    if (!boot || !shutdown || optind != argc) {
+        usage(stderr);
+        exit(2);
+    }
+
+    load_dist(&config.boot, boot);
+    load_dist(&config.shutdown, shutdown);
+    load_dist(&config.halt, halt);
+    load_dist(&config.press, press);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long i, unsafe;
+
+    parse_args(argc, argv);
+
+    if (config.header) {
+        printf("powerwait_ms,bootwait_ms,shutdown_ms,poweroff_ms,idle_ms,long_press_ms,"
+               "trials,unsafe_cut_probability,unsafe_boot,unsafe_shutdown,unsafe_press,"
+               "stuck,usb_losses,battery_s_wasted,battery_s_wasted_per_loss,"
+               "battery_s_wasted_max\n");
+        return 0;
+    }
+
+    rng_state = config.seed ? config.seed : 1;
+    for (i = 0; i < config.trials; i++)
+        trial();
+
+    unsafe = results.unsafe_boot + results.unsafe_shutdown + results.unsafe_press;
+    printf("%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.6f,%lu,%lu,%lu,%lu,%lu,%.3f,%.3f,%.3f\n",
+            model_timers.powerwait, model_timers.bootwait, model_timers.shutdown,
+            model_timers.poweroff, model_timers.idle, model_timers.long_press,
+            results.trials, results.trials ? (double)unsafe / results.trials : 0.0,
+            results.unsafe_boot, results.unsafe_shutdown, results.unsafe_press,
+            results.stuck, results.usb_losses, results.wasted_s,
+            results.usb_losses ? results.wasted_s / results.usb_losses : 0.0,
+            results.wasted_max_s);
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# Sweep the firmware's timer settings against recorded Pi timings.
+#
+# Builds one copy of `sweep` (the host model plus a simulated Pi) for each
+# combination of the timer values below, runs them in parallel with the
+# given arguments, and prints one CSV row per configuration, ordered by
+# unsafe-cut probability and then by battery time wasted. Every
+# configuration uses the same seed, so they see the same sequence of Pi
+# timings.
+#
+# Usage: sweep.sh -b <boot> -S <shutdown> [-H <halt>] [sweep options...]
+#
+# For example, with the shutdown histogram exported by pipowerd:
+#
+#     SWEEP_SHUTDOWN="10000 20000 30000" SWEEP_POWEROFF="5000 10000" \
+#         ./sweep.sh -b boot-times.txt -S /var/lib/prometheus/node-exporter/pipower.prom -H 3
+#
+# Arguments are passed on unquoted, so paths must not contain spaces.
+
+: ${SWEEP_POWERWAIT:=1000}
+: ${SWEEP_BOOTWAIT:=15000 30000 60000}
+: ${SWEEP_SHUTDOWN:=10000 20000 30000}
+: ${SWEEP_POWEROFF:=5000 10000 30000}
+: ${SWEEP_IDLE:=5000}
+: ${SWEEP_LONG_PRESS:=2000}
+: ${SWEEP_JOBS:=$(nproc 2>/dev/null || echo 1)}
+: ${SWEEP_BUILD:=sweep-build}
+
+host=$(cd "$(dirname "$0")" && pwd)
+mkdir -p $SWEEP_BUILD && SWEEP_BUILD=$(cd $SWEEP_BUILD && pwd)
+
+# --variant <powerwait> <bootwait> <shutdown> <poweroff> <idle> <long press>:
+# build and run one configuration (used by the parallel jobs below)
+if [ "$1" = "--variant" ]; then
+    shift
+    dir=$SWEEP_BUILD/$1-$2-$3-$4-$5-$6
+    mkdir -p $dir
+
+    if ! make -s -C $dir -f $host/Makefile HOST=$host sweep HOST_TIMERS="\
+            -DTIMER_POWERWAIT=$1 -DTIMER_BOOTWAIT=$2 -DTIMER_SHUTDOWN=$3 \
+            -DTIMER_POWEROFF=$4 -DTIMER_IDLE=$5 -DLONG_PRESS_DURATION=$6" >&2; then
+        echo "sweep: failed to build $dir" >&2
+        exit 1
+    fi
+
+    exec $dir/sweep $SWEEP_ARGS
+fi
+
+SWEEP_ARGS="$*"
+export SWEEP_ARGS SWEEP_BUILD
+
+# Check the arguments once, rather than in every job.
+make -s -C $host sweep >&2 || exit 1
+$host/sweep --header
+$host/sweep -n 0 "$@" > /dev/null || exit 1
+
+for powerwait in $SWEEP_POWERWAIT; do
+for bootwait in $SWEEP_BOOTWAIT; do
+for shutdown in $SWEEP_SHUTDOWN; do
+for poweroff in $SWEEP_POWEROFF; do
+for idle in $SWEEP_IDLE; do
+for long_press in $SWEEP_LONG_PRESS; do
+    echo $powerwait $bootwait $shutdown $poweroff $idle $long_press
+done
+done
+done
+done
+done
+done | xargs -n 6 -P $SWEEP_JOBS "$0" --variant | sort -t, -k8,8g -k15,15g
@@ -0,0 +1,15 @@
+/**
+ * \file util/atomic.h
+ *
+ * Host stand-in for `<util/atomic.h>`. The model never interrupts
+ * `loop()`, so atomic blocks are ordinary blocks.
+ */
+#ifndef _host_util_atomic_h
+#define _host_util_atomic_h
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+
+#define ATOMIC_BLOCK(type) for (int _atomic_once = 1; _atomic_once; _atomic_once = 0)
+
+#endif // _host_util_atomic_h
@@ -0,0 +1,283 @@
+/**
+ * \file btrace.c
+ *
+ * Compact binary traces of state and pin transitions. See `btrace.h` for
+ * the file format.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btrace.h"
+
+/** Write an unsigned LEB128 integer. */
+static void put_varint(FILE *out, uint64_t v) {
+    do {
+        uint8_t byte = v & 0x7f;
+
+        v >>= 7;
+        if (v)
+            byte |= 0x80;
+        putc(byte, out);
+    } while (v);
+}
+
+/** Read an unsigned LEB128 integer. Returns -1 at end of file. */
+static int get_varint(FILE *in, uint64_t *v) {
+    int shift = 0, c;
+
+    *v = 0;
+    do {
+        c = getc(in);
+        if (c == EOF || shift > 63)
+            return -1;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return 0;
+}
+
+static void write_snapshot(struct btrace_writer *w, uint64_t cycle, const uint8_t *values) {
+    putc(BTRACE_TAG_SNAPSHOT, w->out);
+    put_varint(w->out, cycle);
+    fwrite(values, 1, w->nsignals, w->out);
+    w->last_cycle = cycle;
+}
+
+static void write_change(struct btrace_writer *w, uint64_t cycle, int signal, uint8_t value) {
+    putc(signal, w->out);
+    put_varint(w->out, cycle - w->last_cycle);
+    putc(value, w->out);
+    w->last_cycle = cycle;
+    w->written++;
+}
+
+/** Start a trace.
+ *
+ * Writes the header and an initial snapshot of `initial`.
+ */
+int btrace_writer_init(struct btrace_writer *w, FILE *out, uint32_t frequency,
+        const struct btrace_signal *signals, int nsignals, const uint8_t *initial) {
+    int i;
+
+    if (nsignals > BTRACE_MAX_SIGNALS)
+        return -E2BIG;
+
+    memset(w, 0, sizeof(*w));
+    w->out = out;
+    w->nsignals = nsignals;
+    memcpy(w->values, initial, nsignals);
+
+    fwrite(BTRACE_MAGIC, 1, 4, out);
+    putc(BTRACE_VERSION, out);
+    putc(nsignals, out);
+    for (i = 0; i < 4; i++)
+        putc((frequency >> (8 * i)) & 0xff, out);
+    for (i = 0; i < nsignals; i++) {
+        size_t len = strlen(signals[i].name);
+
+        putc(signals[i].width, out);
+        putc(len, out);
+        fwrite(signals[i].name, 1, len, out);
+    }
+
+    write_snapshot(w, 0, w->values);
+    return 0;
+}
+
+/** Only record around changes of `signal` to `value`.
+ *
+ * Keeps up to `ring_size` changes from the last `pre_cycles` before a
+ * trigger, and records for `post_cycles` after it. `ring_size` must be
+ * at least 1.
+ */
+int btrace_set_trigger(struct btrace_writer *w, int signal, uint8_t value,
+        uint64_t pre_cycles, uint64_t post_cycles, size_t ring_size) {
+    if (ring_size == 0)
+        return -EINVAL;
+
+    w->ring = calloc(ring_size, sizeof(*w->ring));
+    if (!w->ring)
+        return -ENOMEM;
+
+    w->triggered = 1;
+    w->trigger_signal = signal;
+    w->trigger_value = value;
+    w->pre_cycles = pre_cycles;
+    w->post_cycles = post_cycles;
+    w->ring_size = ring_size;
+    memcpy(w->base, w->values, w->nsignals);
+
+    return 0;
+}
+
+/** Do not trigger when the trigger signal changes from `value`.
+ *
+ * For example, ignoring `STATE_POWEROFF1` when triggering on
+ * `STATE_POWEROFF2` captures only unexpected power-offs.
+ */
+void btrace_ignore_from(struct btrace_writer *w, uint8_t value) {
+    w->ignore_from[value / 8] |= 1 << (value % 8);
+}
+
+/** Drop buffered changes that fall outside the pre-trigger window. */
+static void ring_expire(struct btrace_writer *w, uint64_t cycle) {
+    while (w->ring_count > 0) {
+        struct btrace_event *ev = &w->ring[w->ring_head];
+
+        if (w->ring_count < w->ring_size && ev->cycle + w->pre_cycles >= cycle)
+            break;
+
+        w->base[ev->signal] = ev->value;
+        w->base_cycle = ev->cycle;
+        w->ring_head = (w->ring_head + 1) % w->ring_size;
+        w->ring_count--;
+    }
+}
+
+/** Write out the pre-trigger buffer and start a post-trigger window. */
+static void ring_flush(struct btrace_writer *w, uint64_t cycle) {
+    uint64_t start = (cycle > w->pre_cycles) ? cycle - w->pre_cycles : 0;
+
+    if (start < w->base_cycle)
+        start = w->base_cycle;
+    if (start < w->last_cycle)
+        start = w->last_cycle;
+
+    write_snapshot(w, start, w->base);
+    while (w->ring_count > 0) {
+        struct btrace_event *ev = &w->ring[w->ring_head];
+
+        write_change(w, ev->cycle, ev->signal, ev->value);
+        w->ring_head = (w->ring_head + 1) % w->ring_size;
+        w->ring_count--;
+    }
+}
+
+/** Record a change of `signal` to `value` at `cycle`. */
+void btrace_record(struct btrace_writer *w, uint64_t cycle, int signal, uint8_t value) {
+    uint8_t previous = w->values[signal];
+    int trigger;
+
+    w->changes++;
+    w->values[signal] = value;
+
+    if (!w->triggered) {
+        write_change(w, cycle, signal, value);
+        return;
+    }
+
+    trigger = (signal == w->trigger_signal && value == w->trigger_value &&
+            !(w->ignore_from[previous / 8] & (1 << (previous % 8))));
+
+    if (w->recording && cycle > w->post_until) {
+        // The window has closed; buffer from the values as they were
+        // just before this change.
+        w->recording = 0;
+        memcpy(w->base, w->values, w->nsignals);
+        w->base[signal] = previous;
+        w->base_cycle = cycle;
+    }
+
+    if (!w->recording) {
+        struct btrace_event *ev;
+
+        ring_expire(w, cycle);
+        ev = &w->ring[(w->ring_head + w->ring_count) % w->ring_size];
+        ev->cycle = cycle;
+        ev->signal = signal;
+        ev->value = value;
+        w->ring_count++;
+
+        if (!trigger)
+            return;
+
+        ring_flush(w, cycle);
+        w->recording = 1;
+    } else {
+        write_change(w, cycle, signal, value);
+    }
+
+    if (trigger) {
+        w->triggers++;
+        w->post_until = cycle + w->post_cycles;
+    }
+}
+
+/** Flush the trace. The caller owns `out`. */
+void btrace_finish(struct btrace_writer *w) {
+    fflush(w->out);
+    free(w->ring);
+    w->ring = NULL;
+}
+
+/** Read the header of a trace. */
+int btrace_open(struct btrace_reader *r, FILE *in) {
+    uint8_t hdr[10];
+    int i;
+
+    memset(r, 0, sizeof(*r));
+    r->in = in;
+
+    if (fread(hdr, 1, sizeof(hdr), in) != sizeof(hdr) ||
+            memcmp(hdr, BTRACE_MAGIC, 4) != 0)
+        return -EINVAL;
+
+    if (hdr[4] != BTRACE_VERSION || hdr[5] > BTRACE_MAX_SIGNALS)
+        return -ENOTSUP;
+
+    r->nsignals = hdr[5];
+    r->frequency = hdr[6] | hdr[7] << 8 | hdr[8] << 16 | (uint32_t)hdr[9] << 24;
+
+    for (i = 0; i < r->nsignals; i++) {
+        int width = getc(in), len = getc(in);
+
+        if (width == EOF || len == EOF || len >= BTRACE_MAX_NAME ||
+                fread(r->signals[i].name, 1, len, in) != (size_t)len)
+            return -EINVAL;
+        r->signals[i].name[len] = '\0';
+        r->signals[i].width = width;
+    }
+
+    return 0;
+}
+
+/** Read the next record.
+ *
+ * Returns 1 if `rec` was filled in, 0 at end of file and a negative
+ * errno value if the trace is corrupt.
+ */
+int btrace_next(struct btrace_reader *r, struct btrace_record *rec) {
+    uint64_t v;
+    int tag, value;
+
+    tag = getc(r->in);
+    if (tag == EOF)
+        return 0;
+
+    if (tag == BTRACE_TAG_SNAPSHOT) {
+        if (get_varint(r->in, &v) < 0 ||
+                fread(r->values, 1, r->nsignals, r->in) != (size_t)r->nsignals)
+            return -EINVAL;
+
+        r->cycle = v;
+        rec->snapshot = 1;
+        rec->cycle = v;
+        rec->signal = -1;
+        return 1;
+    }
+
+    if (tag >= r->nsignals || get_varint(r->in, &v) < 0 ||
+            (value = getc(r->in)) == EOF)
+        return -EINVAL;
+
+    r->cycle += v;
+    rec->snapshot = 0;
+    rec->cycle = r->cycle;
+    rec->signal = tag;
+    rec->previous = r->values[tag];
+    rec->value = value;
+    r->values[tag] = value;
+    return 1;
+}
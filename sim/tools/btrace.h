@@ -0,0 +1,110 @@
+/**
+ * \file btrace.h
+ *
+ * Compact binary traces of state and pin transitions.
+ *
+ * A trace starts with a header:
+ *
+ *     "PPTR" <version:u8> <nsignals:u8> <frequency:u32le>
+ *     nsignals * (<width:u8> <namelen:u8> <name>)
+ *
+ * followed by records, each introduced by a tag byte:
+ *
+ * - `0x00`..`0x7f`: value change of signal `tag`, followed by the delta
+ *   in cycles since the previous record (LEB128) and the new value (u8).
+ * - `0xff`: snapshot, followed by the absolute cycle count (LEB128) and
+ *   the values of all signals (one u8 each). A snapshot starts the trace
+ *   and every window saved around a trigger; time between snapshots was
+ *   not recorded.
+ *
+ * A value change typically takes 3 bytes, against about 20 for the same
+ * change in VCD.
+ */
+#ifndef _btrace_h
+#define _btrace_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define BTRACE_MAGIC "PPTR"         /**< File signature */
+#define BTRACE_VERSION 1            /**< Format version */
+#define BTRACE_MAX_SIGNALS 32       /**< Maximum number of traced signals */
+#define BTRACE_MAX_NAME 64          /**< Maximum length of a signal name */
+#define BTRACE_TAG_SNAPSHOT 0xff    /**< Tag byte of a snapshot record */
+
+/** A traced signal. */
+struct btrace_signal {
+    char name[BTRACE_MAX_NAME];     /**< signal name, e.g. `PIN_EN` */
+    uint8_t width;                  /**< width in bits (1 or 8) */
+};
+
+/** A buffered value change. */
+struct btrace_event {
+    uint64_t cycle;                 /**< cycle at which the change happened */
+    uint8_t signal,                 /**< index of the signal */
+            value;                  /**< new value */
+};
+
+/** Writes a trace, optionally only around trigger events.
+ *
+ * In triggered mode, changes are kept in a ring buffer covering the last
+ * `pre_cycles`. When the trigger signal changes to the trigger value,
+ * the buffer is written out and recording continues for `post_cycles`,
+ * after which the writer goes back to buffering.
+ */
+struct btrace_writer {
+    FILE *out;
+    int nsignals;
+    uint64_t last_cycle;                        /**< time of the last record written */
+    uint8_t values[BTRACE_MAX_SIGNALS];         /**< current signal values */
+
+    int triggered,                              /**< only record around triggers */
+        recording,                              /**< inside a post-trigger window */
+        trigger_signal;
+    uint8_t trigger_value,
+            ignore_from[256 / 8];               /**< previous values that do not trigger */
+    uint64_t pre_cycles,
+             post_cycles,
+             post_until;                        /**< end of the current window */
+
+    struct btrace_event *ring;                  /**< pre-trigger buffer */
+    size_t ring_size, ring_head, ring_count;
+    uint8_t base[BTRACE_MAX_SIGNALS];           /**< values before the oldest buffered change */
+    uint64_t base_cycle;                        /**< time at which `base` became valid */
+
+    uint64_t changes,                           /**< value changes seen */
+             written,                           /**< value changes written */
+             triggers;                          /**< trigger events */
+};
+
+/** Reads a trace. */
+struct btrace_reader {
+    FILE *in;
+    int nsignals;
+    uint32_t frequency;                         /**< cycles per second */
+    struct btrace_signal signals[BTRACE_MAX_SIGNALS];
+    uint64_t cycle;                             /**< time of the last record read */
+    uint8_t values[BTRACE_MAX_SIGNALS];         /**< current signal values */
+};
+
+/** A record returned by `btrace_next()`. */
+struct btrace_record {
+    int snapshot;       /**< 1 for a snapshot, in which case see `reader.values` */
+    uint64_t cycle;     /**< time of the record */
+    int signal;         /**< index of the changed signal */
+    uint8_t value,      /**< its new value */
+            previous;   /**< its previous value */
+};
+
+int btrace_writer_init(struct btrace_writer *w, FILE *out, uint32_t frequency,
+        const struct btrace_signal *signals, int nsignals, const uint8_t *initial);
+int btrace_set_trigger(struct btrace_writer *w, int signal, uint8_t value,
+        uint64_t pre_cycles, uint64_t post_cycles, size_t ring_size);
+void btrace_ignore_from(struct btrace_writer *w, uint8_t value);
+void btrace_record(struct btrace_writer *w, uint64_t cycle, int signal, uint8_t value);
+void btrace_finish(struct btrace_writer *w);
+
+int btrace_open(struct btrace_reader *r, FILE *in);
+int btrace_next(struct btrace_reader *r, struct btrace_record *rec);
+
+#endif // _btrace_h
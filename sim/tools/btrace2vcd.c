@@ -0,0 +1,98 @@
+/**
+ * \file btrace2vcd.c
+ *
+ * Convert a binary trace written by `simtrace` to VCD for gtkwave.
+ *
+ * Signals are placed in the `logic` scope, as in simavr's own VCD
+ * output, so `pipower.gtkw` works with converted traces. Each snapshot
+ * starts a new window; the gap before it is shown as unchanged values.
+ *
+ * Usage: `btrace2vcd [<trace.bin> [<trace.vcd>]]`
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "btrace.h"
+
+/** Print a value in VCD syntax. */
+static void put_value(FILE *out, struct btrace_reader *r, int signal, uint8_t value) {
+    int bit;
+
+    if (r->signals[signal].width == 1) {
+        fprintf(out, "%d%c\n", value ? 1 : 0, '!' + signal);
+        return;
+    }
+
+    putc('b', out);
+    for (bit = r->signals[signal].width - 1; bit >= 0; bit--)
+        putc((value >> bit) & 1 ? '1' : '0', out);
+    fprintf(out, " %c\n", '!' + signal);
+}
+
+/** Convert cycles to nanoseconds. */
+static uint64_t cycles_to_ns(struct btrace_reader *r, uint64_t cycle) {
+    return (uint64_t)((double)cycle * 1e9 / r->frequency);
+}
+
+int main(int argc, char *argv[]) {
+    struct btrace_reader r;
+    struct btrace_record rec;
+    FILE *in = stdin, *out = stdout;
+    uint64_t last_time = UINT64_MAX;
+    int i, ret;
+
+    if (argc > 3 || (argc > 1 && strcmp(argv[1], "-h") == 0)) {
+        fprintf(stderr, "btrace2vcd: usage: btrace2vcd [<trace.bin> [<trace.vcd>]]\n");
+        return 2;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-") != 0 && !(in = fopen(argv[1], "rb"))) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (argc > 2 && !(out = fopen(argv[2], "w"))) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    if ((ret = btrace_open(&r, in)) < 0) {
+        fprintf(stderr, "btrace2vcd: %s: not a trace: %s\n",
+                argc > 1 ? argv[1] : "<stdin>", strerror(-ret));
+        return 1;
+    }
+
+    if (r.frequency == 0)
+        r.frequency = 1000000;
+
+    fprintf(out, "$timescale 1ns $end\n$scope module logic $end\n");
+    for (i = 0; i < r.nsignals; i++) {
+        fprintf(out, "$var wire %d %c %s $end\n",
+                r.signals[i].width, '!' + i, r.signals[i].name);
+    }
+    fprintf(out, "$upscope $end\n$enddefinitions $end\n");
+
+    while ((ret = btrace_next(&r, &rec)) > 0) {
+        uint64_t t = cycles_to_ns(&r, rec.cycle);
+
+        if (t != last_time) {
+            fprintf(out, "#%llu\n", (unsigned long long)t);
+            last_time = t;
+        }
+
+        if (rec.snapshot) {
+            for (i = 0; i < r.nsignals; i++)
+                put_value(out, &r, i, r.values[i]);
+        } else {
+            put_value(out, &r, rec.signal, rec.value);
+        }
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "btrace2vcd: trace is truncated or corrupt\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,312 @@
+/**
+ * \file btracecheck.c
+ *
+ * Check the binary trace writer and reader in `btrace.c`.
+ *
+ * Without arguments, writes traces of known changes and checks what
+ * reads back:
+ *
+ * - every change, with its cycle, value and previous value, when all
+ *   changes are recorded;
+ * - the snapshots and changes kept around each trigger, for the pre- and
+ *   post-trigger windows, `btrace_ignore_from()` and a full ring buffer;
+ * - that a ring buffer of size 0 is refused.
+ *
+ * With a simavr VCD file and an output path, instead re-encodes the VCD
+ * as a binary trace, as `simtrace` would have recorded it, so that
+ * `btrace2vcd` and the other tools can be checked against the original.
+ * Values that are unknown (`x` or `z`) in the VCD are recorded as 0.
+ *
+ * Usage: `btracecheck [<trace.vcd> <trace.bin>]`
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btrace.h"
+#include "vcd.h"
+
+/** Index of each signal in the test traces. */
+enum { SIG_STATE, SIG_PIN, SIG_SLOW, NUM_SIGNALS };
+
+static const struct btrace_signal signals[NUM_SIGNALS] = {
+    {"STATE", 8},
+    {"PIN_EN", 1},
+    {"SLOW", 8},
+};
+
+/** A record expected in a trace. */
+struct expect {
+    int snapshot;
+    uint64_t cycle;
+    int signal;
+    uint8_t value,
+            previous,
+            values[NUM_SIGNALS];    /**< for a snapshot, the value of each signal */
+};
+
+/** A change to record. */
+struct change {
+    uint64_t cycle;
+    int signal;
+    uint8_t value;
+};
+
+static int failures;
+
+static void fail(const char *test, int i, const char *what) {
+    fprintf(stderr, "btracecheck: %s: record %d: %s\n", test, i, what);
+    failures++;
+}
+
+/** Write `changes` to a trace and check that it reads back as `expect`.
+ *
+ * If `ring_size` is non-zero, record only around changes of `STATE` to
+ * `trigger`.
+ */
+static void check(const char *test, const struct change *changes, int nchanges,
+        const struct expect *expect, int nexpect, size_t ring_size, uint8_t trigger,
+        uint64_t pre_cycles, uint64_t post_cycles, int ignore_from) {
+    static const uint8_t initial[NUM_SIGNALS] = {0, 0, 0};
+    struct btrace_writer w;
+    struct btrace_reader r;
+    struct btrace_record rec;
+    FILE *f = tmpfile();
+    int i, ret;
+
+    if (!f) {
+        perror("btracecheck: tmpfile");
+        exit(1);
+    }
+
+    btrace_writer_init(&w, f, 8000000, signals, NUM_SIGNALS, initial);
+    if (ring_size) {
+        ret = btrace_set_trigger(&w, SIG_STATE, trigger, pre_cycles, post_cycles,
+                ring_size);
+        if (ret < 0) {
+            fprintf(stderr, "btracecheck: %s: btrace_set_trigger: %s\n",
+                    test, strerror(-ret));
+            exit(1);
+        }
+        if (ignore_from >= 0)
+            btrace_ignore_from(&w, ignore_from);
+    }
+    for (i = 0; i < nchanges; i++)
+        btrace_record(&w, changes[i].cycle, changes[i].signal, changes[i].value);
+    btrace_finish(&w);
+
+    rewind(f);
+    if ((ret = btrace_open(&r, f)) < 0) {
+        fprintf(stderr, "btracecheck: %s: btrace_open: %s\n", test, strerror(-ret));
+        failures++;
+        fclose(f);
+        return;
+    }
+
+    if (r.nsignals != NUM_SIGNALS || r.frequency != 8000000)
+        fail(test, -1, "wrong header");
+    for (i = 0; i < r.nsignals && i < NUM_SIGNALS; i++) {
+        if (strcmp(r.signals[i].name, signals[i].name) != 0 ||
+                r.signals[i].width != signals[i].width)
+            fail(test, -1, "wrong signal in header");
+    }
+
+    for (i = 0; (ret = btrace_next(&r, &rec)) > 0; i++) {
+        const struct expect *e = &expect[i];
+
+        if (i >= nexpect) {
+            fail(test, i, "unexpected record");
+            break;
+        }
+
+        if (rec.snapshot != e->snapshot || rec.cycle != e->cycle)
+            fail(test, i, "wrong kind or cycle");
+        else if (e->snapshot && memcmp(r.values, e->values, NUM_SIGNALS) != 0)
+            fail(test, i, "wrong snapshot values");
+        else if (!e->snapshot && (rec.signal != e->signal || rec.value != e->value ||
+                    rec.previous != e->previous))
+            fail(test, i, "wrong change");
+    }
+
+    if (ret < 0)
+        fail(test, i, "corrupt trace");
+    else if (i < nexpect)
+        fail(test, i, "missing record");
+
+    fclose(f);
+}
+
+/** Every change is recorded, including deltas that need several bytes. */
+static void check_all() {
+    static const struct change changes[] = {
+        {1, SIG_PIN, 1},
+        {1, SIG_STATE, 3},
+        {200, SIG_SLOW, 0xff},
+        {200 + (1ULL << 40), SIG_PIN, 0},
+        {200 + (1ULL << 40), SIG_STATE, 4},
+    };
+    static const struct expect expect[] = {
+        {1, 0, 0, 0, 0, {0, 0, 0}},
+        {0, 1, SIG_PIN, 1, 0, {0}},
+        {0, 1, SIG_STATE, 3, 0, {0}},
+        {0, 200, SIG_SLOW, 0xff, 0, {0}},
+        {0, 200 + (1ULL << 40), SIG_PIN, 0, 1, {0}},
+        {0, 200 + (1ULL << 40), SIG_STATE, 4, 3, {0}},
+    };
+
+    check("all changes", changes, sizeof(changes) / sizeof(changes[0]),
+            expect, sizeof(expect) / sizeof(expect[0]), 0, 0, 0, 0, -1);
+}
+
+/** Only changes within 100 cycles before and 50 after a change of
+ * `STATE` to 5 are kept, except after a change from 3. */
+static void check_trigger() {
+    static const struct change changes[] = {
+        {10, SIG_PIN, 1},           // before the pre-trigger window
+        {20, SIG_PIN, 0},
+        {150, SIG_PIN, 1},          // in the window
+        {200, SIG_STATE, 5},        // trigger
+        {230, SIG_PIN, 0},          // in the post-trigger window
+        {260, SIG_PIN, 1},          // after it
+        {1000, SIG_STATE, 0},
+        {1050, SIG_STATE, 5},       // trigger
+        {1200, SIG_STATE, 3},
+        {1210, SIG_STATE, 5},       // ignored: from 3
+        {1220, SIG_PIN, 0},
+    };
+    static const struct expect expect[] = {
+        {1, 0, 0, 0, 0, {0, 0, 0}},
+        {1, 100, 0, 0, 0, {0, 0, 0}},
+        {0, 150, SIG_PIN, 1, 0, {0}},
+        {0, 200, SIG_STATE, 5, 0, {0}},
+        {0, 230, SIG_PIN, 0, 1, {0}},
+        {1, 950, 0, 0, 0, {5, 1, 0}},
+        {0, 1000, SIG_STATE, 0, 5, {0}},
+        {0, 1050, SIG_STATE, 5, 0, {0}},
+    };
+
+    check("trigger", changes, sizeof(changes) / sizeof(changes[0]),
+            expect, sizeof(expect) / sizeof(expect[0]), 8, 5, 100, 50, 3);
+}
+
+/** A full ring buffer drops the oldest changes, however long the
+ * pre-trigger window. */
+static void check_ring_full() {
+    static const struct change changes[] = {
+        {10, SIG_PIN, 1},
+        {20, SIG_PIN, 0},
+        {30, SIG_PIN, 1},
+        {40, SIG_STATE, 5},
+    };
+    static const struct expect expect[] = {
+        {1, 0, 0, 0, 0, {0, 0, 0}},
+        {1, 20, 0, 0, 0, {0, 0, 0}},
+        {0, 30, SIG_PIN, 1, 0, {0}},
+        {0, 40, SIG_STATE, 5, 0, {0}},
+    };
+
+    check("full ring", changes, sizeof(changes) / sizeof(changes[0]),
+            expect, sizeof(expect) / sizeof(expect[0]), 2, 5, 1000, 0, -1);
+}
+
+/** A ring buffer must hold at least one change. */
+static void check_ring_empty() {
+    static const uint8_t initial[NUM_SIGNALS] = {0, 0, 0};
+    struct btrace_writer w;
+    FILE *f = tmpfile();
+
+    if (!f) {
+        perror("btracecheck: tmpfile");
+        exit(1);
+    }
+
+    btrace_writer_init(&w, f, 8000000, signals, NUM_SIGNALS, initial);
+    if (btrace_set_trigger(&w, SIG_STATE, 5, 100, 100, 0) != -EINVAL) {
+        fprintf(stderr, "btracecheck: empty ring: accepted\n");
+        failures++;
+    }
+    btrace_finish(&w);
+    fclose(f);
+}
+
+/** Re-encode the VCD file at `in` as a binary trace at `out`. */
+static int encode(const char *in, const char *out) {
+    struct btrace_signal sigs[BTRACE_MAX_SIGNALS];
+    uint8_t initial[BTRACE_MAX_SIGNALS] = {0};
+    struct btrace_writer w;
+    struct vcd vcd;
+    struct vcd_change ch;
+    FILE *f;
+    int i, ret;
+
+    if ((ret = vcd_open(&vcd, in)) < 0) {
+        fprintf(stderr, "btracecheck: %s: %s\n", in, strerror(-ret));
+        return 1;
+    }
+
+    if (vcd.nsignals > BTRACE_MAX_SIGNALS || 1000000000000ULL % vcd.timescale_ps != 0 ||
+            1000000000000ULL / vcd.timescale_ps > UINT32_MAX) {
+        fprintf(stderr, "btracecheck: %s: cannot encode this trace\n", in);
+        vcd_close(&vcd);
+        return 1;
+    }
+
+    memset(sigs, 0, sizeof(sigs));
+    for (i = 0; i < vcd.nsignals; i++) {
+        if (vcd.signals[i].width > 8) {
+            fprintf(stderr, "btracecheck: %s: %s is wider than 8 bits\n",
+                    in, vcd.signals[i].name);
+            vcd_close(&vcd);
+            return 1;
+        }
+        strncpy(sigs[i].name, vcd.signals[i].name, BTRACE_MAX_NAME - 1);
+        sigs[i].width = vcd.signals[i].width;
+    }
+
+    if (!(f = fopen(out, "wb"))) {
+        fprintf(stderr, "btracecheck: %s: %s\n", out, strerror(errno));
+        vcd_close(&vcd);
+        return 1;
+    }
+
+    // One cycle per VCD time unit
+    btrace_writer_init(&w, f, 1000000000000ULL / vcd.timescale_ps, sigs,
+            vcd.nsignals, initial);
+    while (vcd_next(&vcd, &ch)) {
+        if (ch.value != VCD_UNKNOWN)
+            btrace_record(&w, ch.time_ps / vcd.timescale_ps, ch.signal, ch.value);
+    }
+    btrace_finish(&w);
+    vcd_close(&vcd);
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "btracecheck: %s: %s\n", out, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 3)
+        return encode(argv[1], argv[2]);
+
+    if (argc != 1) {
+        fprintf(stderr, "btracecheck: usage: btracecheck [<trace.vcd> <trace.bin>]\n");
+        return 2;
+    }
+
+    check_all();
+    check_trigger();
+    check_ring_full();
+    check_ring_empty();
+
+    if (failures)
+        return 1;
+
+    printf("btrace: all checks passed\n");
+    return 0;
+}
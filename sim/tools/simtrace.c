@@ -0,0 +1,366 @@
+/**
+ * \file simtrace.c
+ *
+ * Run firmware under simavr and write a compact binary trace (see
+ * `btrace.h`) instead of VCD.
+ *
+ * The signals to trace are taken from the `_mytrace` table that
+ * `simavr.c` places in the `.mmcu` section, so a firmware built with
+ * `TRACE=1` can be traced either way. simavr's own VCD output is turned
+ * off. Traced locations are sampled after every instruction, and only
+ * changes are recorded.
+ *
+ * With `--trigger`, only a window around each trigger event is kept;
+ * for example, to keep 10 s either side of a power-off that did not come
+ * from `STATE_POWEROFF1`:
+ *
+ *     simtrace -T STATE=STATE_POWEROFF2 -X STATE_POWEROFF1 \
+ *         --pre 10000 --post 10000 -o soak.bin -g pipower.elf
+ *
+ * Inputs can be driven from gdb as usual (`-g`).
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_gdb.h>
+#include <simavr/avr/avr_mcu_section.h>
+
+#include "btrace.h"
+#include "state_names.h"
+
+#ifndef DEFAULT_MCU
+#define DEFAULT_MCU "attiny85"      /**< MCU to simulate if the ELF does not say */
+#endif
+
+#ifndef DEFAULT_FREQUENCY
+#define DEFAULT_FREQUENCY 1000000   /**< Clock to simulate if the ELF does not say */
+#endif
+
+#ifndef DEFAULT_RING_SIZE
+#define DEFAULT_RING_SIZE 65536     /**< Changes kept before a trigger */
+#endif
+
+#define OPT_OUTPUT 'o'          /**< `--output|-o <file>` */
+#define OPT_MCU 'm'             /**< `--mcu|-m <name>` */
+#define OPT_FREQUENCY 'f'       /**< `--frequency|-f <hz>` */
+#define OPT_GDB 'g'             /**< `--gdb|-g` */
+#define OPT_TRIGGER 'T'         /**< `--trigger|-T <signal>=<value>` */
+#define OPT_IGNORE_FROM 'X'     /**< `--ignore-from|-X <value>` */
+#define OPT_PRE 'b'             /**< `--pre|-b <ms>` */
+#define OPT_POST 'a'            /**< `--post|-a <ms>` */
+#define OPT_RING 'r'            /**< `--ring|-r <changes>` */
+#define OPT_DURATION 'd'        /**< `--duration|-d <seconds>` */
+#define OPT_HELP 'h'            /**< `--help|-h` */
+
+#define OPTSTRING "o:m:f:gT:X:b:a:r:d:h"
+
+const struct option longopts[] = {
+    {"output", required_argument, 0, OPT_OUTPUT},
+    {"mcu", required_argument, 0, OPT_MCU},
+    {"frequency", required_argument, 0, OPT_FREQUENCY},
+    {"gdb", no_argument, 0, OPT_GDB},
+    {"trigger", required_argument, 0, OPT_TRIGGER},
+    {"ignore-from", required_argument, 0, OPT_IGNORE_FROM},
+    {"pre", required_argument, 0, OPT_PRE},
+    {"post", required_argument, 0, OPT_POST},
+    {"ring", required_argument, 0, OPT_RING},
+    {"duration", required_argument, 0, OPT_DURATION},
+    {"help", no_argument, 0, OPT_HELP},
+    {0, 0, 0, 0},
+};
+
+/** Maximum number of `--ignore-from` values */
+#define MAX_IGNORE 16
+
+struct config {
+    char *output,
+         *mcu,
+         *trigger_signal,
+         *trigger_value,
+         *ignore_from[MAX_IGNORE];
+    int nignore;
+    uint32_t frequency;
+    int gdb;
+    unsigned long pre_ms, post_ms, ring_size;
+    double duration;
+} config = {
+    .output = "trace.bin",
+    .pre_ms = 10000,
+    .post_ms = 10000,
+    .ring_size = DEFAULT_RING_SIZE,
+};
+
+/** A memory location to watch. */
+struct watch {
+    uint16_t addr;
+    uint8_t mask;
+};
+
+static volatile sig_atomic_t quit;
+
+static void handle_signal(int sig) {
+    (void)sig;
+    quit = 1;
+}
+
+void usage(FILE *out) {
+    fprintf(out, "simtrace: usage: simtrace [-o <file>] [-m <mcu>] [-f <hz>] [-g] [-d <seconds>]\n"
+                 "                [-T <signal>=<value> [-X <value>...] [-b <ms>] [-a <ms>] [-r <changes>]]\n"
+                 "                <firmware.elf>\n");
+}
+
+/** Parse a value, accepting state names as well as numbers. */
+int parse_value(const char *s) {
+    char *end;
+    long v = strtol(s, &end, 0);
+
+    if (*end == '\0' && v >= 0 && v <= 255)
+        return v;
+
+    return state_lookup(s);
+}
+
+/** Parse the number given for option `name`, exiting if it is not one. */
+unsigned long parse_number(const char *name, const char *s) {
+    char *end;
+    unsigned long v;
+
+    errno = 0;
+    v = strtoul(s, &end, 0);
+    if (errno || end == s || *end != '\0' || *s == '-') {
+        fprintf(stderr, "simtrace: invalid --%s %s\n", name, s);
+        exit(2);
+    }
+
+    return v;
+}
+
+void parse_args(int argc, char *argv[]) {
+    int ch;
+
+    while (EOF != (ch = getopt_long(argc, argv, OPTSTRING, longopts, NULL))) {
+        switch (ch) {
+            case OPT_OUTPUT:
+                config.output = optarg;
+                break;
+
+            case OPT_MCU:
+                config.mcu = optarg;
+                break;
+
+            case OPT_FREQUENCY:
+                config.frequency = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_GDB:
+                config.gdb = 1;
+                break;
+
+            case OPT_TRIGGER:
+                config.trigger_signal = optarg;
+                config.trigger_value = strchr(optarg, '=');
+                if (!config.trigger_value) {
+                    fprintf(stderr, "simtrace: invalid trigger (want <signal>=<value>): %s\n", optarg);
+                    exit(2);
+                }
+                *config.trigger_value++ = '\0';
+                break;
+
+            case OPT_IGNORE_FROM:
+                if (config.nignore == MAX_IGNORE) {
+                    fprintf(stderr, "simtrace: too many --ignore-from values\n");
+                    exit(2);
+                }
+                config.ignore_from[config.nignore++] = optarg;
+                break;
+
+            case OPT_PRE:
+                config.pre_ms = parse_number("pre", optarg);
+                break;
+
+            case OPT_POST:
+                config.post_ms = parse_number("post", optarg);
+                break;
+
+            case OPT_RING:
+                config.ring_size = parse_number("ring", optarg);
+                if (config.ring_size == 0) {
+                    fprintf(stderr, "simtrace: --ring must be at least 1\n");
+                    exit(2);
+                }
+                break;
+
+            case OPT_DURATION:
+                config.duration = strtod(optarg, NULL);
+                break;
+
+            case OPT_HELP:
+                usage(stdout);
+                exit(0);
+
+            default:
+                usage(stderr);
+                exit(2);
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(stderr);
+        exit(2);
+    }
+}
+
+/** Read the current value of a watched location. */
+static inline uint8_t sample(avr_t *avr, struct watch *w) {
+    uint8_t v = avr->data[w->addr];
+
+    return w->mask ? !!(v & w->mask) : v;
+}
+
+int main(int argc, char *argv[]) {
+    static struct btrace_signal signals[BTRACE_MAX_SIGNALS];
+    struct watch watches[BTRACE_MAX_SIGNALS];
+    uint8_t values[BTRACE_MAX_SIGNALS];
+    struct btrace_writer writer;
+    elf_firmware_t firmware;
+    avr_cycle_count_t limit = 0;
+    avr_t *avr;
+    FILE *out;
+    int nsignals = 0, state = cpu_Running, i, ret;
+
+    parse_args(argc, argv);
+
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(argv[optind], &firmware) != 0) {
+        fprintf(stderr, "simtrace: failed to load %s\n", argv[optind]);
+        return 1;
+    }
+
+    if (config.mcu)
+        strncpy(firmware.mmcu, config.mcu, sizeof(firmware.mmcu) - 1);
+    if (!firmware.mmcu[0])
+        strcpy(firmware.mmcu, DEFAULT_MCU);
+    if (config.frequency)
+        firmware.frequency = config.frequency;
+    if (!firmware.frequency)
+        firmware.frequency = DEFAULT_FREQUENCY;
+
+    // Take over the memory traces declared in the firmware, and stop
+    // simavr from writing its own VCD.
+    for (i = 0; i < firmware.trace_count && nsignals < BTRACE_MAX_SIGNALS; i++) {
+        if (firmware.trace[i].kind != AVR_MMCU_TAG_VCD_TRACE)
+            continue;
+
+        strncpy(signals[nsignals].name, firmware.trace[i].name, BTRACE_MAX_NAME - 1);
+        signals[nsignals].width = firmware.trace[i].mask ? 1 : 8;
+        watches[nsignals].addr = firmware.trace[i].addr;
+        watches[nsignals].mask = firmware.trace[i].mask;
+        nsignals++;
+    }
+    firmware.trace_count = 0;
+
+    if (nsignals == 0) {
+        fprintf(stderr, "simtrace: %s declares no traces (build with TRACE=1)\n", argv[optind]);
+        return 1;
+    }
+
+    avr = avr_make_mcu_by_name(firmware.mmcu);
+    if (!avr) {
+        fprintf(stderr, "simtrace: unknown mcu %s\n", firmware.mmcu);
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+
+    if (config.gdb) {
+        avr->gdb_port = 1234;
+        avr->state = cpu_Stopped;
+        avr_gdb_init(avr);
+    }
+
+    out = fopen(config.output, "wb");
+    if (!out) {
+        fprintf(stderr, "simtrace: %s: %s\n", config.output, strerror(errno));
+        return 1;
+    }
+
+    for (i = 0; i < nsignals; i++)
+        values[i] = sample(avr, &watches[i]);
+    btrace_writer_init(&writer, out, firmware.frequency, signals, nsignals, values);
+
+    if (config.trigger_signal) {
+        int sig = -1, value = parse_value(config.trigger_value);
+
+        for (i = 0; i < nsignals; i++) {
+            if (strcmp(signals[i].name, config.trigger_signal) == 0)
+                sig = i;
+        }
+
+        if (sig < 0 || value < 0) {
+            fprintf(stderr, "simtrace: invalid trigger %s=%s\n",
+                    config.trigger_signal, config.trigger_value);
+            return 2;
+        }
+
+        ret = btrace_set_trigger(&writer, sig, value,
+                (uint64_t)config.pre_ms * firmware.frequency / 1000,
+                (uint64_t)config.post_ms * firmware.frequency / 1000,
+                config.ring_size);
+        if (ret < 0) {
+            fprintf(stderr, "simtrace: failed to set trigger: %s\n", strerror(-ret));
+            return 1;
+        }
+
+        for (i = 0; i < config.nignore; i++) {
+            int from = parse_value(config.ignore_from[i]);
+
+            if (from < 0) {
+                fprintf(stderr, "simtrace: invalid value %s\n", config.ignore_from[i]);
+                return 2;
+            }
+            btrace_ignore_from(&writer, from);
+        }
+    }
+
+    if (config.duration > 0)
+        limit = config.duration * firmware.frequency;
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    while (!quit && state != cpu_Done && state != cpu_Crashed) {
+        state = avr_run(avr);
+
+        for (i = 0; i < nsignals; i++) {
+            uint8_t v = sample(avr, &watches[i]);
+
+            if (v != values[i]) {
+                values[i] = v;
+                btrace_record(&writer, avr->cycle, i, v);
+            }
+        }
+
+        if (limit && avr->cycle >= limit)
+            break;
+    }
+
+    fprintf(stderr, "simtrace: %llu cycles, %llu changes, %llu written, %llu triggers\n",
+            (unsigned long long)avr->cycle,
+            (unsigned long long)writer.changes,
+            (unsigned long long)writer.written,
+            (unsigned long long)writer.triggers);
+
+    btrace_finish(&writer);
+    fclose(out);
+    avr_terminate(avr);
+
+    return state == cpu_Crashed;
+}
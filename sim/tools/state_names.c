@@ -0,0 +1,48 @@
+/**
+ * \file state_names.c
+ *
+ * Names of the controller states, for host-side tools. These match the
+ * names used in `states.dot` and `state_filter.txt`.
+ */
+#include <string.h>
+
+#include "state_names.h"
+
+static const char *names[NUM_STATES] = {
+    [STATE_START] = "STATE_START",
+    [STATE_POWERWAIT0] = "STATE_POWERWAIT0",
+    [STATE_POWERWAIT1] = "STATE_POWERWAIT1",
+    [STATE_POWERON] = "STATE_POWERON",
+    [STATE_BOOTWAIT0] = "STATE_BOOTWAIT0",
+    [STATE_BOOTWAIT1] = "STATE_BOOTWAIT1",
+    [STATE_BOOT] = "STATE_BOOT",
+    [STATE_SHUTDOWN0] = "STATE_SHUTDOWN0",
+    [STATE_SHUTDOWN1] = "STATE_SHUTDOWN1",
+    [STATE_POWEROFF0] = "STATE_POWEROFF0",
+    [STATE_POWEROFF1] = "STATE_POWEROFF1",
+    [STATE_POWEROFF2] = "STATE_POWEROFF2",
+    [STATE_IDLE0] = "STATE_IDLE0",
+    [STATE_IDLE1] = "STATE_IDLE1",
+    [STATE_IDLE2] = "STATE_IDLE2",
+    [STATE_UNMANAGED0] = "STATE_UNMANAGED0",
+    [STATE_UNMANAGED1] = "STATE_UNMANAGED1",
+    [STATE_UNMANAGED2] = "STATE_UNMANAGED2",
+    [STATE_QUIT] = "STATE_QUIT",
+};
+
+/** Return the name of a state, or NULL if it is out of range. */
+const char *state_name(unsigned int state) {
+    return (state < NUM_STATES) ? names[state] : NULL;
+}
+
+/** Return the state called `name` (with or without `STATE_`), or -1. */
+int state_lookup(const char *name) {
+    int i;
+
+    for (i = 0; i < NUM_STATES; i++) {
+        if (strcmp(names[i], name) == 0 || strcmp(names[i] + 6, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
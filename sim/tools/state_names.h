@@ -0,0 +1,17 @@
+/**
+ * \file state_names.h
+ *
+ * Names of the controller states, for host-side tools.
+ */
+#ifndef _state_names_h
+#define _state_names_h
+
+#include "states.h"
+
+/** Number of states, including `STATE_QUIT` */
+#define NUM_STATES (STATE_QUIT + 1)
+
+const char *state_name(unsigned int state);
+int state_lookup(const char *name);
+
+#endif // _state_names_h
@@ -0,0 +1,615 @@
+/**
+ * \file statecheck.c
+ *
+ * Check `states.dot` against the firmware and recorded traces.
+ *
+ * Three sets of state transitions are compared:
+ *
+ * - documented: the edges in `states.dot`. Lines starting with `#` are
+ *   comments. An edge from a state to itself documents an action that
+ *   leaves `state` unchanged, and is not checked.
+ * - in the source (`--source`): every `state = STATE_...` assignment in
+ *   `loop()`. Inside `switch (state)` an assignment is a transition from
+ *   the `case` labels it is under; outside it, from every state allowed
+ *   by the enclosing `if (state == ...)`/`else` chain.
+ * - seen: changes of the `STATE` signal in each trace, which may be a
+ *   simavr VCD file, a binary trace from `simtrace`, or a text file of
+ *   `<from> -> <to> [<count>]` lines such as `explore --replay` prints and
+ *   `explore --transitions` writes. A change across the gap before a
+ *   snapshot in a binary trace is not counted.
+ *
+ * Each difference is printed on its own line:
+ *
+ * - `undocumented: <from> -> <to> (...)`: in the source or seen, but not
+ *   in the graph;
+ * - `not in source: <from> -> <to>`: in the graph, but the code cannot
+ *   make it;
+ * - `unseen: <from> -> <to>`: in the graph, but in none of the traces.
+ *
+ * The exit status is 1 if anything is undocumented or not in the source;
+ * unseen transitions only measure how much the traces cover, and fail
+ * the check only with `--unseen`.
+ *
+ * Usage: `statecheck [-d <states.dot>] [-c <pipower.c>] [-u] [<trace>...]`
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btrace.h"
+#include "state_names.h"
+#include "vcd.h"
+
+#define MAX_TOKEN 64            /**< Longest identifier in `states.dot` or the source */
+#define MAX_DEPTH 32            /**< Deepest brace nesting followed in `loop()` */
+
+/** States a transition may start from; `STATE_QUIT` is only for debugging. */
+#define ALL_STATES ((1UL << STATE_QUIT) - 1)
+
+#define OPT_DOT 'd'             /**< `--dot|-d <states.dot>` */
+#define OPT_SOURCE 'c'          /**< `--source|-c <pipower.c>` */
+#define OPT_UNSEEN 'u'          /**< `--unseen|-u` */
+#define OPT_HELP 'h'            /**< `--help|-h` */
+
+#define OPTSTRING "d:c:uh"
+
+struct option longopts[] = {
+    {"dot", required_argument, 0, OPT_DOT},
+    {"source", required_argument, 0, OPT_SOURCE},
+    {"unseen", no_argument, 0, OPT_UNSEEN},
+    {"help", no_argument, 0, OPT_HELP},
+    {0, 0, 0, 0},
+};
+
+struct config {
+    char *dot,
+         *source;
+    int unseen;
+} config = {
+    .dot = "states.dot",
+};
+
+/** Transitions known from each source. */
+uint8_t documented[NUM_STATES][NUM_STATES],
+        in_source[NUM_STATES][NUM_STATES];
+uint64_t seen[NUM_STATES][NUM_STATES];
+
+uint64_t bad_values;    /**< `STATE` changes to values that are not states */
+int traces;             /**< traces read */
+
+static void see(unsigned int from, unsigned int to, uint64_t count) {
+    if (from >= NUM_STATES || to >= NUM_STATES)
+        bad_values += count;
+    else if (from != to)
+        seen[from][to] += count;
+}
+
+/** Look up a state, complaining if it does not exist. */
+static int lookup(const char *path, int lineno, const char *name) {
+    int s = state_lookup(name);
+
+    if (s < 0)
+        fprintf(stderr, "statecheck: %s:%d: unknown state %s\n", path, lineno, name);
+    return s;
+}
+
+/** Read the edges of `states.dot`, including chains such as `A->B->C`.
+ * Attribute lists and quoted strings are skipped. */
+static int read_dot(const char *path) {
+    char line[1024], name[MAX_TOKEN];
+    int lineno = 0, from, errors = 0;
+    FILE *in = fopen(path, "r");
+
+    if (!in)
+        return -errno;
+
+    while (fgets(line, sizeof(line), in)) {
+        char *p = line + strspn(line, " \t");
+        int brackets = 0, arrow = 0;
+
+        lineno++;
+        from = -1;
+        if (*p == '#' || (p[0] == '/' && p[1] == '/'))
+            continue;
+
+        while (*p) {
+            if (*p == '"') {
+                p = strchr(p + 1, '"');
+                p = p ? p + 1 : line + strlen(line);
+            } else if (*p == '[') {
+                brackets++, p++;
+            } else if (*p == ']') {
+                brackets--, p++;
+            } else if (brackets) {
+                p++;
+            } else if (p[0] == '-' && p[1] == '>') {
+                arrow = 1, p += 2;
+            } else if (isalnum((unsigned char)*p) || *p == '_') {
+                size_t len = 0;
+                int to;
+
+                while ((isalnum((unsigned char)*p) || *p == '_') && len < sizeof(name) - 1)
+                    name[len++] = *p++;
+                name[len] = '\0';
+
+                if (!arrow) {
+                    from = strncmp(name, "STATE_", 6) == 0 ? lookup(path, lineno, name) : -1;
+                    errors += (from < 0 && strncmp(name, "STATE_", 6) == 0);
+                    continue;
+                }
+
+                to = lookup(path, lineno, name);
+                if (from >= 0 && to >= 0)
+                    documented[from][to] = 1;
+                errors += (from < 0 || to < 0);
+                from = to;
+                arrow = 0;
+            } else {
+                p++;
+            }
+        }
+    }
+
+    fclose(in);
+    return errors ? -EINVAL : 0;
+}
+
+/** A C token: an identifier, or a single punctuation character, except
+ * that `==` and `!=` are kept whole. */
+struct lexer {
+    const char *pos, *end;
+    int lineno;
+    char token[MAX_TOKEN];
+};
+
+static int next_token(struct lexer *lx) {
+    const char *p = lx->pos;
+    size_t len = 0;
+
+    for (;;) {
+        while (p < lx->end && isspace((unsigned char)*p))
+            lx->lineno += (*p++ == '\n');
+
+        if (p + 1 < lx->end && p[0] == '/' && p[1] == '/') {
+            while (p < lx->end && *p != '\n')
+                p++;
+        } else if (p + 1 < lx->end && p[0] == '/' && p[1] == '*') {
+            for (p += 2; p + 1 < lx->end && !(p[0] == '*' && p[1] == '/'); p++)
+                lx->lineno += (*p == '\n');
+            p += 2;
+        } else if (p < lx->end && (*p == '"' || *p == '\'')) {
+            char quote = *p++;
+
+            while (p < lx->end && *p != quote)
+                p += (*p == '\\') ? 2 : 1;
+            p++;
+        } else if (p < lx->end && *p == '#') {
+            // Preprocessor line, including continuations.
+            while (p < lx->end && !(*p == '\n' && p[-1] != '\\'))
+                p++;
+        } else {
+            break;
+        }
+    }
+
+    if (p >= lx->end) {
+        lx->pos = lx->end;
+        return 0;
+    }
+
+    if (isalnum((unsigned char)*p) || *p == '_') {
+        while (p < lx->end && (isalnum((unsigned char)*p) || *p == '_')) {
+            if (len < sizeof(lx->token) - 1)
+                lx->token[len++] = *p;
+            p++;
+        }
+    } else {
+        lx->token[len++] = *p++;
+        if ((lx->token[0] == '=' || lx->token[0] == '!') && p < lx->end && *p == '=')
+            lx->token[len++] = *p++;
+    }
+
+    lx->token[len] = '\0';
+    lx->pos = p;
+    return 1;
+}
+
+static int is(struct lexer *lx, const char *token) {
+    return strcmp(lx->token, token) == 0;
+}
+
+/** Read the condition of an `if`, up to its closing parenthesis, and
+ * return the states it can be true in; `*otherwise` is set to those it
+ * can be false in. Only `state == X` and `state != X` restrict the sets;
+ * anything else may be true or false in any state. */
+static unsigned long read_condition(struct lexer *lx, const char *path,
+        unsigned long *otherwise) {
+    unsigned long states = ALL_STATES;
+    int depth = 0, tokens = 0, s = -1;
+    char op[3] = "";
+
+    while (next_token(lx)) {
+        if (is(lx, "("))
+            depth++;
+        else if (is(lx, ")") && --depth == 0)
+            break;
+
+        if (depth == 1 && !is(lx, "(")) {
+            tokens++;
+            if (tokens == 1 && !is(lx, "state"))
+                tokens = 100;
+            else if (tokens == 2)
+                strcpy(op, is(lx, "==") || is(lx, "!=") ? lx->token : "");
+            else if (tokens == 3)
+                s = lookup(path, lx->lineno, lx->token);
+        }
+    }
+
+    *otherwise = ALL_STATES;
+    if (tokens == 3 && s >= 0 && op[0] == '=') {
+        states = 1UL << s;
+        *otherwise = ALL_STATES & ~states;
+    } else if (tokens == 3 && s >= 0 && op[0] == '!') {
+        *otherwise = 1UL << s;
+        states = ALL_STATES & ~*otherwise;
+    }
+
+    return states;
+}
+
+/** Extract the transitions `loop()` can make from its source. */
+static int read_source(const char *path) {
+    struct lexer lx = {0};
+    char *text;
+    long size;
+    FILE *in = fopen(path, "r");
+
+    // States each open block can be entered in, the states not yet taken
+    // by the `if`/`else` chain at each depth, and the `case` labels of
+    // the current switch arm.
+    unsigned long block[MAX_DEPTH], chain[MAX_DEPTH], next_block = ALL_STATES,
+                  labels = 0;
+    int depth = 0, switch_depth = -1, in_loop = 0, after_label = 0, assignments = 0,
+        after_else = 0, member = 0;
+
+    if (!in)
+        return -errno;
+
+    fseek(in, 0, SEEK_END);
+    size = ftell(in);
+    rewind(in);
+    text = malloc(size + 1);
+    if (!text || fread(text, 1, size, in) != (size_t)size) {
+        free(text);
+        fclose(in);
+        return -EIO;
+    }
+    fclose(in);
+
+    lx.pos = text;
+    lx.end = text + size;
+    lx.lineno = 1;
+    block[0] = chain[0] = ALL_STATES;
+
+    while (next_token(&lx)) {
+        int was_else = after_else, was_member = member;
+
+        after_else = is(&lx, "else");
+        member = is(&lx, ".") || is(&lx, ">");
+
+        if (!in_loop) {
+            // `void loop() {`
+            if (is(&lx, "loop") && next_token(&lx) && is(&lx, "(") &&
+                    next_token(&lx) && is(&lx, ")") && next_token(&lx) && is(&lx, "{")) {
+                in_loop = 1;
+                depth = 1;
+                block[1] = chain[1] = ALL_STATES;
+            }
+            continue;
+        }
+
+        if (is(&lx, "{")) {
+            if (++depth >= MAX_DEPTH) {
+                fprintf(stderr, "statecheck: %s:%d: nested too deeply\n", path, lx.lineno);
+                break;
+            }
+            block[depth] = next_block & block[depth - 1];
+            chain[depth] = block[depth];
+            next_block = ALL_STATES;
+        } else if (is(&lx, "}")) {
+            if (depth == switch_depth)
+                switch_depth = -1;
+            if (--depth == 0)
+                break;
+        } else if (is(&lx, "if")) {
+            unsigned long otherwise,
+                          cond = read_condition(&lx, path, &otherwise);
+
+            if (!was_else)
+                chain[depth] = block[depth];
+            next_block = chain[depth] & cond;
+            chain[depth] &= otherwise;
+        } else if (is(&lx, "else")) {
+            // `else if` continues the chain; a plain `else` takes the rest.
+            next_block = chain[depth];
+        } else if (is(&lx, ";")) {
+            // Any statement ends an `if`/`else` chain.
+            chain[depth] = block[depth];
+            after_label = 0;
+        } else if (is(&lx, "switch")) {
+            if (next_token(&lx) && is(&lx, "(") && next_token(&lx) && is(&lx, "state"))
+                switch_depth = depth + 1;
+        } else if (is(&lx, "case") && depth == switch_depth) {
+            int s;
+
+            if (!after_label)
+                labels = 0;
+            if (next_token(&lx) && (s = lookup(path, lx.lineno, lx.token)) >= 0)
+                labels |= 1UL << s;
+            next_token(&lx);    // ':'
+            after_label = 1;
+        } else if (is(&lx, "default") && depth == switch_depth) {
+            labels = ALL_STATES;
+            next_token(&lx);
+            after_label = 1;
+        } else if (is(&lx, "state") && !was_member) {
+            unsigned long from;
+            int to, s;
+
+            if (!next_token(&lx) || !is(&lx, "=") || !next_token(&lx))
+                continue;
+            if ((to = lookup(path, lx.lineno, lx.token)) < 0)
+                continue;
+
+            from = block[depth];
+            if (switch_depth >= 0 && depth >= switch_depth)
+                from &= labels;
+            for (s = 0; s < NUM_STATES; s++) {
+                if ((from & 1UL << s) && s != to)
+                    in_source[s][to] = 1;
+            }
+            assignments++;
+        }
+    }
+
+    free(text);
+
+    if (!in_loop || !assignments) {
+        fprintf(stderr, "statecheck: %s: no state assignments found in loop()\n", path);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/** Count `STATE` changes in a VCD file. */
+static int read_vcd(const char *path) {
+    struct vcd vcd;
+    struct vcd_change ch;
+    uint64_t state = VCD_UNKNOWN;
+    int ret, sig;
+
+    if ((ret = vcd_open(&vcd, path)) < 0)
+        return ret;
+
+    if ((sig = vcd_find(&vcd, "STATE")) < 0) {
+        vcd_close(&vcd);
+        return -ENOENT;
+    }
+
+    while (vcd_next(&vcd, &ch)) {
+        if (ch.signal != sig || ch.value == state)
+            continue;
+        if (state != VCD_UNKNOWN && ch.value != VCD_UNKNOWN)
+            see(state, ch.value, 1);
+        state = ch.value;
+    }
+
+    vcd_close(&vcd);
+    return 0;
+}
+
+/** Count `STATE` changes in a binary trace. */
+static int read_btrace(FILE *in) {
+    struct btrace_reader r;
+    struct btrace_record rec;
+    int i, ret, sig = -1;
+
+    if ((ret = btrace_open(&r, in)) < 0)
+        return ret;
+
+    for (i = 0; i < r.nsignals; i++) {
+        if (strcmp(r.signals[i].name, "STATE") == 0)
+            sig = i;
+    }
+    if (sig < 0)
+        return -ENOENT;
+
+    while ((ret = btrace_next(&r, &rec)) > 0) {
+        if (!rec.snapshot && rec.signal == sig)
+            see(rec.previous, rec.value, 1);
+    }
+
+    return ret;
+}
+
+/** Count `<from> -> <to> [<count>]` lines, wherever they appear on a
+ * line. */
+static int read_text(FILE *in, const char *path) {
+    char line[1024], from[MAX_TOKEN], to[MAX_TOKEN];
+    int lineno = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        char *arrow = strstr(line, " -> "), *start;
+        unsigned long long count = 1;
+        int f, t;
+
+        lineno++;
+        if (line[0] == '#' || !arrow)
+            continue;
+
+        for (start = arrow; start > line && !isspace((unsigned char)start[-1]); start--)
+            ;
+        if (sscanf(start, "%63s -> %63s %llu", from, to, &count) < 2)
+            continue;
+
+        f = lookup(path, lineno, from);
+        t = lookup(path, lineno, to);
+        if (f < 0 || t < 0)
+            return -EINVAL;
+        see(f, t, count);
+    }
+
+    return 0;
+}
+
+/** Read one trace, whichever kind it is. */
+static int read_trace(const char *path) {
+    char magic[4] = "";
+    FILE *in = fopen(path, "rb");
+    int ret;
+
+    if (!in)
+        return -errno;
+
+    if (fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+            memcmp(magic, BTRACE_MAGIC, 4) == 0) {
+        rewind(in);
+        ret = read_btrace(in);
+    } else if (magic[0] == '$') {
+        ret = read_vcd(path);
+    } else {
+        rewind(in);
+        ret = read_text(in, path);
+    }
+
+    fclose(in);
+    return ret;
+}
+
+static void print_edge(const char *what, int from, int to) {
+    printf("%s: %s -> %s", what, state_name(from), state_name(to));
+}
+
+/** Print the differences and return the number that fail the check. */
+static int report() {
+    int from, to, failures = 0;
+    unsigned int ndoc = 0, nsource = 0, nseen = 0;
+
+    for (from = 0; from < NUM_STATES; from++) {
+        for (to = 0; to < NUM_STATES; to++) {
+            if (from == to)
+                continue;
+
+            ndoc += documented[from][to];
+            nsource += in_source[from][to];
+            nseen += seen[from][to] != 0;
+
+            if (!documented[from][to] && (in_source[from][to] || seen[from][to])) {
+                print_edge("undocumented", from, to);
+                if (in_source[from][to] && seen[from][to])
+                    printf(" (source, seen %llu times)\n", (unsigned long long)seen[from][to]);
+                else if (seen[from][to])
+                    printf(" (seen %llu times)\n", (unsigned long long)seen[from][to]);
+                else
+                    printf(" (source)\n");
+                failures++;
+            }
+
+            if (config.source && !in_source[from][to] &&
+                    (documented[from][to] || seen[from][to])) {
+                print_edge("not in source", from, to);
+                if (seen[from][to])
+                    printf(" (seen %llu times)", (unsigned long long)seen[from][to]);
+                printf("\n");
+                failures++;
+            }
+
+            if (traces && documented[from][to] && !seen[from][to]) {
+                print_edge("unseen", from, to);
+                printf("\n");
+                failures += config.unseen;
+            }
+        }
+    }
+
+    if (bad_values) {
+        printf("invalid: STATE took a value that is not a state %llu times\n",
+                (unsigned long long)bad_values);
+        failures++;
+    }
+
+    printf("%u documented", ndoc);
+    if (config.source)
+        printf(", %u in source", nsource);
+    if (traces)
+        printf(", %u seen in %d trace%s", nseen, traces, traces == 1 ? "" : "s");
+    printf("\n");
+
+    return failures;
+}
+
+void usage(FILE *out) {
+    fprintf(out, "statecheck: usage: statecheck [-d <states.dot>] [-c <pipower.c>] [-u] [<trace>...]\n");
+}
+
+void parse_args(int argc, char *argv[]) {
+    int ch;
+
+    while (EOF != (ch = getopt_long(argc, argv, OPTSTRING, longopts, NULL))) {
+        switch (ch) {
+            case OPT_DOT:
+                config.dot = optarg;
+                break;
+
+            case OPT_SOURCE:
+                config.source = optarg;
+                break;
+
+            case OPT_UNSEEN:
+                config.unseen = 1;
+                break;
+
+            case OPT_HELP:
+                usage(stdout);
+                exit(0);
+
+            default:
+                usage(stderr);
+                exit(2);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int i, ret;
+
+    parse_args(argc, argv);
+
+    if ((ret = read_dot(config.dot)) < 0) {
+        fprintf(stderr, "statecheck: %s: %s\n", config.dot, strerror(-ret));
+        return 2;
+    }
+
+    if (config.source && (ret = read_source(config.source)) < 0) {
+        if (ret != -EINVAL)
+            fprintf(stderr, "statecheck: %s: %s\n", config.source, strerror(-ret));
+        return 2;
+    }
+
+    for (i = optind; i < argc; i++) {
+        if ((ret = read_trace(argv[i])) < 0) {
+            fprintf(stderr, "statecheck: %s: %s\n", argv[i],
+                    ret == -ENOENT ? "no STATE signal" : strerror(-ret));
+            return 2;
+        }
+        traces++;
+    }
+
+    return report() ? 1 : 0;
+}
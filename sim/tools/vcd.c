@@ -0,0 +1,297 @@
+/**
+ * \file vcd.c
+ *
+ * Streaming reader for the VCD files written by simavr.
+ *
+ * This handles the subset of VCD that simavr produces: scalar (`0!`) and
+ * vector (`b0101 !`) value changes, `#` timestamps and the usual header
+ * sections. Real values (`r1.5 !`) are skipped.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vcd.h"
+
+/** Return the next whitespace-delimited token, or NULL at end of file. */
+static const char *next_token(struct vcd *vcd, size_t *len) {
+    const char *p = vcd->pos, *start;
+
+    while (p < vcd->end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+
+    if (p == vcd->end) {
+        vcd->pos = p;
+        return NULL;
+    }
+
+    start = p;
+    while (p < vcd->end && !(*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+
+    vcd->pos = p;
+    *len = p - start;
+    return start;
+}
+
+/** Return true if a token equals the string `s`. */
+static int token_is(const char *tok, size_t len, const char *s) {
+    return tok && strlen(s) == len && memcmp(tok, s, len) == 0;
+}
+
+/** Parse the decimal digits at the start of a token.
+ *
+ * The file is mapped without a terminating NUL, so the standard
+ * conversions, which stop only at a non-digit, could read past its end.
+ */
+static uint64_t token_uint(const char *tok, size_t len) {
+    uint64_t value = 0;
+    size_t i;
+
+    for (i = 0; i < len && tok[i] >= '0' && tok[i] <= '9'; i++)
+        value = value * 10 + (tok[i] - '0');
+
+    return value;
+}
+
+/** Skip tokens up to and including `$end`. */
+static void skip_section(struct vcd *vcd) {
+    const char *tok;
+    size_t len;
+
+    while ((tok = next_token(vcd, &len)) && !token_is(tok, len, "$end"))
+        ;
+}
+
+/** Parse the contents of a `$timescale` section, e.g. `10ns` or `1 us`. */
+static void parse_timescale(struct vcd *vcd) {
+    static const struct { const char *unit; uint64_t ps; } units[] = {
+        {"s", 1000000000000ULL}, {"ms", 1000000000ULL}, {"us", 1000000ULL},
+        {"ns", 1000ULL}, {"ps", 1ULL},
+    };
+    char buf[32] = "";
+    const char *tok;
+    size_t len, used = 0;
+    char *unit;
+    uint64_t scale;
+    unsigned int i;
+
+    while ((tok = next_token(vcd, &len)) && !token_is(tok, len, "$end")) {
+        if (used + len < sizeof(buf)) {
+            memcpy(buf + used, tok, len);
+            used += len;
+            buf[used] = '\0';
+        }
+    }
+
+    scale = strtoull(buf, &unit, 10);
+    for (i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+        if (strcmp(unit, units[i].unit) == 0)
+            vcd->timescale_ps = scale * units[i].ps;
+    }
+}
+
+/** Parse a `$var <type> <width> <id> <name> [<range>] $end` section. */
+static void parse_var(struct vcd *vcd) {
+    struct vcd_signal *sig;
+    const char *tok;
+    size_t len;
+
+    if (vcd->nsignals == VCD_MAX_SIGNALS) {
+        skip_section(vcd);
+        return;
+    }
+
+    sig = &vcd->signals[vcd->nsignals];
+
+    next_token(vcd, &len);                      // type
+    tok = next_token(vcd, &len);                // width
+    sig->width = tok ? token_uint(tok, len) : 0;
+
+    tok = next_token(vcd, &len);                // identifier
+    if (!tok || len >= VCD_MAX_ID) {
+        skip_section(vcd);
+        return;
+    }
+    memcpy(sig->id, tok, len);
+    sig->id[len] = '\0';
+
+    tok = next_token(vcd, &len);                // reference
+    if (!tok) {
+        return;
+    }
+    if (len >= VCD_MAX_NAME)
+        len = VCD_MAX_NAME - 1;
+    memcpy(sig->name, tok, len);
+    sig->name[len] = '\0';
+
+    skip_section(vcd);
+
+    if (strlen(sig->id) == 1 && (unsigned char)sig->id[0] < 128)
+        vcd->by_char[(unsigned char)sig->id[0]] = vcd->nsignals;
+
+    vcd->nsignals++;
+}
+
+/** Parse the header, stopping after `$enddefinitions $end`. */
+static int parse_header(struct vcd *vcd) {
+    const char *tok;
+    size_t len;
+
+    while ((tok = next_token(vcd, &len))) {
+        if (token_is(tok, len, "$timescale")) {
+            parse_timescale(vcd);
+        } else if (token_is(tok, len, "$var")) {
+            parse_var(vcd);
+        } else if (token_is(tok, len, "$enddefinitions")) {
+            skip_section(vcd);
+            return 0;
+        } else if (*tok == '$') {
+            skip_section(vcd);
+        }
+    }
+
+    return -EINVAL;
+}
+
+/** Map a VCD file and parse its header. */
+int vcd_open(struct vcd *vcd, const char *path) {
+    struct stat st;
+    int fd, ret;
+
+    memset(vcd, 0, sizeof(*vcd));
+    memset(vcd->by_char, -1, sizeof(vcd->by_char));
+    vcd->timescale_ps = 1;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -errno;
+
+    if (fstat(fd, &st) == -1) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+
+    vcd->size = st.st_size;
+    if (vcd->size > 0) {
+        vcd->data = mmap(NULL, vcd->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (vcd->data == MAP_FAILED) {
+            ret = -errno;
+            close(fd);
+            return ret;
+        }
+        posix_madvise((void *)vcd->data, vcd->size, POSIX_MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    vcd->pos = vcd->data;
+    vcd->end = vcd->data + vcd->size;
+
+    ret = parse_header(vcd);
+    if (ret < 0)
+        vcd_close(vcd);
+
+    return ret;
+}
+
+void vcd_close(struct vcd *vcd) {
+    if (vcd->size > 0)
+        munmap((void *)vcd->data, vcd->size);
+    vcd->data = vcd->pos = vcd->end = NULL;
+    vcd->size = 0;
+}
+
+/** Return the index of the signal called `name`, or -1. */
+int vcd_find(struct vcd *vcd, const char *name) {
+    int i;
+
+    for (i = 0; i < vcd->nsignals; i++) {
+        if (strcmp(vcd->signals[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/** Look up a signal by identifier code. */
+static int lookup(struct vcd *vcd, const char *id, size_t len) {
+    int i;
+
+    if (len == 1 && (unsigned char)*id < 128)
+        return vcd->by_char[(unsigned char)*id];
+
+    for (i = 0; i < vcd->nsignals; i++) {
+        if (strlen(vcd->signals[i].id) == len &&
+                memcmp(vcd->signals[i].id, id, len) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/** Read the next value change.
+ *
+ * Returns 1 if `change` was filled in, 0 at end of file.
+ */
+int vcd_next(struct vcd *vcd, struct vcd_change *change) {
+    const char *tok;
+    size_t len, i;
+
+    while ((tok = next_token(vcd, &len))) {
+        uint64_t value = 0;
+        int sig;
+
+        switch (*tok) {
+            case '#':
+                vcd->time_ps = token_uint(tok + 1, len - 1) * vcd->timescale_ps;
+                continue;
+
+            case '$':
+                // $dumpvars, $dumpon, $end etc. just bracket value changes
+                if (token_is(tok, len, "$comment"))
+                    skip_section(vcd);
+                continue;
+
+            case '0': case '1': case 'x': case 'X': case 'z': case 'Z':
+                sig = lookup(vcd, tok + 1, len - 1);
+                value = (*tok == '0') ? 0 : (*tok == '1') ? 1 : VCD_UNKNOWN;
+                break;
+
+            case 'b': case 'B':
+                for (i = 1; i < len; i++) {
+                    if (tok[i] != '0' && tok[i] != '1') {
+                        value = VCD_UNKNOWN;
+                        break;
+                    }
+                    value = value << 1 | (tok[i] - '0');
+                }
+                tok = next_token(vcd, &len);
+                sig = tok ? lookup(vcd, tok, len) : -1;
+                break;
+
+            case 'r': case 'R':
+                next_token(vcd, &len);
+                continue;
+
+            default:
+                continue;
+        }
+
+        if (sig < 0)
+            continue;
+
+        change->time_ps = vcd->time_ps;
+        change->signal = sig;
+        change->value = value;
+        return 1;
+    }
+
+    return 0;
+}
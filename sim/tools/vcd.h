@@ -0,0 +1,58 @@
+/**
+ * \file vcd.h
+ *
+ * Streaming reader for the VCD files written by simavr.
+ */
+#ifndef _vcd_h
+#define _vcd_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VCD_MAX_SIGNALS 32      /**< Maximum number of `$var` declarations */
+#define VCD_MAX_NAME 32         /**< Maximum length of a signal name */
+#define VCD_MAX_ID 8            /**< Maximum length of a signal identifier */
+
+/** Value of a signal whose state is unknown (`x` or `z`) */
+#define VCD_UNKNOWN UINT64_MAX
+
+/** A signal declared in the VCD header. */
+struct vcd_signal {
+    char id[VCD_MAX_ID],        /**< identifier code used in value changes */
+         name[VCD_MAX_NAME];    /**< reference name, e.g. `PIN_EN` */
+    int width;                  /**< size in bits */
+};
+
+/** A single value change. */
+struct vcd_change {
+    uint64_t time_ps;   /**< simulation time in picoseconds */
+    int signal;         /**< index into `vcd.signals` */
+    uint64_t value;     /**< new value, or `VCD_UNKNOWN` */
+};
+
+/** An open VCD file.
+ *
+ * The file is mapped into memory and read in a single pass, so memory
+ * use does not depend on the size of the trace.
+ */
+struct vcd {
+    const char *data,           /**< start of mapping */
+               *pos,            /**< current read position */
+               *end;            /**< end of mapping */
+    size_t size;                /**< size of mapping */
+
+    uint64_t timescale_ps,      /**< picoseconds per time unit */
+             time_ps;           /**< time of the most recent `#` record */
+
+    int nsignals;               /**< number of declared signals */
+    struct vcd_signal signals[VCD_MAX_SIGNALS];
+
+    signed char by_char[128];   /**< signal index for one-character identifiers */
+};
+
+int vcd_open(struct vcd *vcd, const char *path);
+void vcd_close(struct vcd *vcd);
+int vcd_find(struct vcd *vcd, const char *name);
+int vcd_next(struct vcd *vcd, struct vcd_change *change);
+
+#endif // _vcd_h
@@ -0,0 +1,286 @@
+/**
+ * \file vcdstat.c
+ *
+ * Compute state residency and power-off latencies from simavr VCD traces.
+ *
+ * Each trace is read in a single streaming pass using the `STATE`,
+ * `PIN_EN`, `PIN_SHUTDOWN`, `PIN_BOOT` and `PIN_USB` signals declared in
+ * `simavr.c`, so memory use is constant however long the trace is. One
+ * JSON object is written per trace:
+ *
+ * - `states`: time spent in and number of entries into each state
+ * - `usb_loss_to_en_drop`: `PIN_USB` falling to `PIN_EN` falling
+ * - `shutdown_to_boot_release`: `PIN_SHUTDOWN` rising to `PIN_BOOT` rising
+ * - `shutdown_to_power_off`: `PIN_SHUTDOWN` rising to `PIN_EN` falling
+ *
+ * Usage: `vcdstat <trace.vcd>...`
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state_names.h"
+#include "vcd.h"
+
+#define OPT_HELP 'h'            /**< `--help|-h` */
+
+#define OPTSTRING "h"
+
+const struct option longopts[] = {
+    {"help", no_argument, 0, OPT_HELP},
+    {0, 0, 0, 0},
+};
+
+/** Number of distinct values an 8-bit `STATE` trace can take */
+#define STATE_VALUES 256
+
+/** Statistics for one kind of interval. */
+struct interval {
+    const char *name;       /**< name in the report */
+    uint64_t count,         /**< completed intervals */
+             unfinished,    /**< intervals abandoned or still open at end of trace */
+             sum_ps,
+             min_ps,
+             max_ps,
+             start_ps;      /**< start of the open interval */
+    int open;               /**< an interval has started */
+};
+
+/** Analysis state for one trace. */
+struct analysis {
+    int sig_state, sig_en, sig_shutdown, sig_boot, sig_usb;
+
+    uint64_t state,                 /**< current STATE value */
+             state_since_ps,        /**< time at which it was entered */
+             en, shutdown, boot, usb;
+
+    uint64_t residency_ps[STATE_VALUES],
+             entries[STATE_VALUES],
+             transitions,
+             first_ps,              /**< time of the first known STATE */
+             last_ps;
+
+    int started;                    /**< STATE has been known at some point */
+
+    struct interval usb_loss, shutdown_boot, shutdown_off;
+};
+
+static void interval_start(struct interval *iv, uint64_t t) {
+    if (iv->open)
+        iv->unfinished++;
+    iv->open = 1;
+    iv->start_ps = t;
+}
+
+static void interval_cancel(struct interval *iv) {
+    if (iv->open)
+        iv->unfinished++;
+    iv->open = 0;
+}
+
+static void interval_end(struct interval *iv, uint64_t t) {
+    uint64_t d;
+
+    if (!iv->open)
+        return;
+
+    d = t - iv->start_ps;
+    if (iv->count == 0 || d < iv->min_ps)
+        iv->min_ps = d;
+    if (d > iv->max_ps)
+        iv->max_ps = d;
+    iv->sum_ps += d;
+    iv->count++;
+    iv->open = 0;
+}
+
+/** Apply a value change to a 1-bit signal, returning +1 on a rising edge,
+ * -1 on a falling edge and 0 otherwise. */
+static int update_pin(uint64_t *pin, uint64_t value) {
+    uint64_t old = *pin;
+
+    *pin = value;
+    if (old == 0 && value == 1)
+        return 1;
+    if (old == 1 && value == 0)
+        return -1;
+    return 0;
+}
+
+static void handle_change(struct analysis *a, struct vcd_change *ch) {
+    uint64_t t = ch->time_ps;
+    int edge;
+
+    a->last_ps = t;
+
+    if (ch->signal == a->sig_state) {
+        if (ch->value == a->state)
+            return;
+
+        if (a->state < STATE_VALUES)
+            a->residency_ps[a->state] += t - a->state_since_ps;
+        else if (!a->started)
+            a->first_ps = t;
+        a->started = 1;
+
+        if (ch->value < STATE_VALUES) {
+            a->entries[ch->value]++;
+            if (a->state < STATE_VALUES)
+                a->transitions++;
+        }
+
+        a->state = ch->value;
+        a->state_since_ps = t;
+    } else if (ch->signal == a->sig_usb) {
+        edge = update_pin(&a->usb, ch->value);
+        if (edge < 0 && a->en == 1)
+            interval_start(&a->usb_loss, t);
+        else if (edge > 0)
+            interval_cancel(&a->usb_loss);
+    } else if (ch->signal == a->sig_shutdown) {
+        edge = update_pin(&a->shutdown, ch->value);
+        if (edge > 0 && a->en == 1) {
+            interval_start(&a->shutdown_boot, t);
+            interval_start(&a->shutdown_off, t);
+        }
+    } else if (ch->signal == a->sig_boot) {
+        edge = update_pin(&a->boot, ch->value);
+        if (edge > 0)
+            interval_end(&a->shutdown_boot, t);
+    } else if (ch->signal == a->sig_en) {
+        edge = update_pin(&a->en, ch->value);
+        if (edge < 0) {
+            interval_end(&a->usb_loss, t);
+            interval_end(&a->shutdown_off, t);
+            interval_cancel(&a->shutdown_boot);
+        }
+    }
+}
+
+static void print_interval(struct interval *iv) {
+    printf("\"%s\":{\"count\":%llu,\"unfinished\":%llu", iv->name,
+            (unsigned long long)iv->count,
+            (unsigned long long)(iv->unfinished + iv->open));
+    if (iv->count > 0) {
+        printf(",\"min_s\":%.9f,\"mean_s\":%.9f,\"max_s\":%.9f",
+                iv->min_ps / 1e12, (double)iv->sum_ps / iv->count / 1e12,
+                iv->max_ps / 1e12);
+    }
+    printf("}");
+}
+
+static void report(const char *path, struct analysis *a) {
+    uint64_t duration = a->last_ps - a->first_ps;
+    const char *sep = "";
+    int i;
+
+    if (a->state < STATE_VALUES)
+        a->residency_ps[a->state] += a->last_ps - a->state_since_ps;
+
+    printf("{\"file\":\"%s\",\"duration_s\":%.9f,\"transitions\":%llu,\"states\":{",
+            path, duration / 1e12, (unsigned long long)a->transitions);
+    for (i = 0; i < STATE_VALUES; i++) {
+        const char *name = state_name(i);
+        char unknown[16];
+
+        if (a->entries[i] == 0)
+            continue;
+
+        if (!name) {
+            snprintf(unknown, sizeof(unknown), "%d", i);
+            name = unknown;
+        }
+
+        printf("%s\"%s\":{\"residency_s\":%.9f,\"fraction\":%.6f,\"entries\":%llu}",
+                sep, name, a->residency_ps[i] / 1e12,
+                duration ? (double)a->residency_ps[i] / duration : 0.0,
+                (unsigned long long)a->entries[i]);
+        sep = ",";
+    }
+    printf("},");
+    print_interval(&a->usb_loss);
+    printf(",");
+    print_interval(&a->shutdown_boot);
+    printf(",");
+    print_interval(&a->shutdown_off);
+    printf("}\n");
+}
+
+/** Analyze one trace. Returns 0 on success. */
+static int analyze(const char *path) {
+    static struct analysis a;
+    struct vcd_change ch;
+    struct vcd vcd;
+    int ret;
+
+    ret = vcd_open(&vcd, path);
+    if (ret < 0) {
+        fprintf(stderr, "vcdstat: %s: %s\n", path, strerror(-ret));
+        return 1;
+    }
+
+    memset(&a, 0, sizeof(a));
+    a.usb_loss.name = "usb_loss_to_en_drop";
+    a.shutdown_boot.name = "shutdown_to_boot_release";
+    a.shutdown_off.name = "shutdown_to_power_off";
+    a.state = a.en = a.shutdown = a.boot = a.usb = VCD_UNKNOWN;
+
+    a.sig_state = vcd_find(&vcd, "STATE");
+    a.sig_en = vcd_find(&vcd, "PIN_EN");
+    a.sig_shutdown = vcd_find(&vcd, "PIN_SHUTDOWN");
+    a.sig_boot = vcd_find(&vcd, "PIN_BOOT");
+    a.sig_usb = vcd_find(&vcd, "PIN_USB");
+
+    if (a.sig_state < 0) {
+        fprintf(stderr, "vcdstat: %s: no STATE signal\n", path);
+        vcd_close(&vcd);
+        return 1;
+    }
+
+    while (vcd_next(&vcd, &ch))
+        handle_change(&a, &ch);
+
+    report(path, &a);
+    vcd_close(&vcd);
+    return 0;
+}
+
+void usage(FILE *out) {
+    fprintf(out, "vcdstat: usage: vcdstat <trace.vcd>...\n");
+}
+
+void parse_args(int argc, char *argv[]) {
+    int ch;
+
+    while (EOF != (ch = getopt_long(argc, argv, OPTSTRING, longopts, NULL))) {
+        switch (ch) {
+            case OPT_HELP:
+                usage(stdout);
+                exit(0);
+
+            default:
+                usage(stderr);
+                exit(2);
+        }
+    }
+
+    if (optind == argc) {
+        usage(stderr);
+        exit(2);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int i, ret = 0;
+
+    parse_args(argc, argv);
+
+    for (i = optind; i < argc; i++)
+        ret |= analyze(argv[i]);
+
+    return ret;
+}